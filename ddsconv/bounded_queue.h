@@ -0,0 +1,54 @@
+﻿#ifndef BOUNDED_QUEUE_H__
+#define BOUNDED_QUEUE_H__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace util {
+
+// 容量に上限のあるスレッド間キュー。
+// 満杯の場合push()は空きができるまで待機し、close()後に空になるとpop()はfalseを返す。
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) noexcept : mCapacity(capacity) { }
+
+    BoundedQueue(BoundedQueue const&) = delete;
+    BoundedQueue& operator=(BoundedQueue const&) = delete;
+
+    void push(T value) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mNotFull.wait(lock, [&] { return mItems.size() < mCapacity; });
+        mItems.push_back(std::move(value));
+        mNotEmpty.notify_one();
+    }
+
+    bool pop(T& value) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mNotEmpty.wait(lock, [&] { return mClosed || !mItems.empty(); });
+        if (mItems.empty()) return false;
+        value = std::move(mItems.front());
+        mItems.pop_front();
+        mNotFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mClosed = true;
+        mNotEmpty.notify_all();
+    }
+
+private:
+    size_t mCapacity;
+    std::deque<T> mItems;
+    std::mutex mMutex;
+    std::condition_variable mNotFull;
+    std::condition_variable mNotEmpty;
+    bool mClosed = false;
+};
+
+}
+
+#endif
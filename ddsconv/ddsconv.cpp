@@ -1,452 +1,829 @@
-﻿#include <cassert>
-#include <cstdint>
-
-#include <algorithm>
-#include <memory>
-#include <map>
-#include <string>
-#include <vector>
-
-#define WIN32_LEAN_AND_MEAN
-#define NOMINMAX
-#include <Windows.h>
-
-#include "DirectXTex.h"
-#include "ispc_texcomp.h"
-#include "image.h"
-
-#define VERSION "1.1.0"
-
-#define ABORT(msg) { puts(msg); return 1; }
-#define ARG_CASE(s) if (kv.first == s)
-#define ARG_CASE2(s1, s2) if (kv.first == s1 || kv.first == s2)
-#define CHECK_NUM_ARGS(p) if (kv.second.size() < p) continue;
-#define ROUNDUP(x,n) ((((x)+(n)-1)/(n))*(n))
-
-namespace {
-
-const char helpText[] = 
-    "\n"
-    "ddsconv v" VERSION "\n"
-    "---------------------------------------------------------------------\n"
-    "  Usage: ddsconv <input specification> <options>\n"
-    "\n"
-    "INPUT SPECIFICATION\n"
-    "  -i, --input <filename>\n"
-        "\t入力ファイルパスを指定します。\n"
-    "\n"
-    "OPTIONS\n"
-    "  -f, --format <format>\n"
-        "\t圧縮フォーマットを指定します。\n"
-        "\tbc1  - RGB画像、またはRGBA画像(1bitアルファ)。\n"
-        "\tbc3  - RGBA画像(多階調アルファ)。\n"
-        "\tbc5  - 2成分のデータ(法線マップなど)。DX10以降。\n"
-        "\tbc6h - HDRのRGB画像。DX10以降。\n"
-        "\tbc7  - RGB画像、またはRGBA画像(多階調アルファ)。DX10以降。\n"
-    "  -h, --help\n"
-        "\tこれを表示します。\n"
-    "  -l, --linearColorSpace\n"
-        "\tsRGBカラー空間からリニアカラー空間へ変換します。\n"
-    "  -m, --miplevels <levels>\n"
-        "\t元画像を含むミップマップレベルを指定します。\n"
-        "\t0を指定した場合は1x1までのミップマップを出力します。\n"
-    "  -o, --output <filename>\n"
-        "\t出力ファイルパスを指定します。初期値は\"output.dds\"です。\n"
-    "  -q, --quality <level>\n"
-        "\tBC7/BC6Hの圧縮速度と品質を指定します。初期値は\"ultrafast\"です。\n"
-        "\tultrafast - 最高速度。\n"
-        "\tveryfast  - 非常に高速。\n"
-        "\tfast      - 高速。\n"
-        "\tbasic     - 中間。\n"
-        "\tslow      - 高品質。\n"
-        "\tveryslow  - 最高品質。\n"
-    "  --forceRgb\n"
-        "\tBC7の圧縮時にアルファチャンネルを無視します。\n"
-        "\tわずかに圧縮速度が向上しますが、サイズには影響しません。\n"
-    "  -v, --verbose\n"
-        "\t詳細な出力を行います。\n"
-    "\n";
-
-struct Level {
-    enum Type {
-        ULTRA_FAST,
-        VERY_FAST,
-        FAST,
-        BASIC,
-        SLOW,
-        VERY_SLOW,
-    };
-};
-
-struct Spec {
-    std::wstring source;
-    std::wstring output = L"output.dds";
-    DXGI_FORMAT format = DXGI_FORMAT_BC7_UNORM;
-    Level::Type level = Level::ULTRA_FAST;
-    uint32_t mipLevels = 0;
-    bool forceRgbSpecified = false;
-    bool mipmapSpecified = false;
-    bool linearColorSpecified = false;
-    bool verboseSpecified = false;
-};
-
-std::map<std::string, std::vector<std::string>> parseOptions(int argc, char* argv[]) {
-    std::map<std::string, std::vector<std::string>> options;
-    int argPos = 1;
-    bool suggestHelp = false;
-    while (argPos < argc) {
-        const char* arg = argv[argPos];
-        if (arg[0] != '-') {
-            printf("Unknown setting or insufficient parameters: %s\n", arg);
-            suggestHelp = true;
-        }
-        else {
-            int pos = argPos;
-            while (pos+1 < argc) {
-                if (argv[pos+1][0] == '-') break;
-                ++pos;
-            }
-            int count = pos - argPos;
-            if (count <= 0) {
-                options[arg].clear();
-                ++argPos;
-            }
-            else {
-                for (int i = argPos+1, end = i+count; i < end; ++i)
-                    options[arg].push_back(argv[i]);
-                argPos += 1 + count;
-            }
-        }
-    }
-    if (suggestHelp) printf("Use --help for more information.\n");
-    return options;
-}
-
-std::wstring utf8ToUtf16(const std::string& u8str) {
-    int u16strLen = ::MultiByteToWideChar(CP_UTF8, 0, u8str.c_str(), -1, NULL, 0);
-    if (u16strLen <= 0) return std::wstring();
-    std::wstring u16str;
-    u16str.resize(static_cast<size_t>(u16strLen) - 1);
-    ::MultiByteToWideChar(CP_UTF8, 0, u8str.c_str(), -1, &u16str[0], u16strLen);
-    return u16str;
-}
-
-std::string utf16ToUtf8(const std::wstring& u16str) {
-    int u8strLen = ::WideCharToMultiByte(CP_UTF8, 0, u16str.c_str(), -1, NULL, 0, NULL, NULL);
-    if (u8strLen <= 0) return std::string();
-    std::string u8str;
-    u8str.resize(static_cast<size_t>(u8strLen) - 1);
-    ::WideCharToMultiByte(CP_UTF8, 0, u16str.c_str(), -1, &u8str[0], u8strLen, NULL, NULL);
-    return u8str;
-}
-
-int parseArguments(Spec& spec, int argc, char* argv[]) {
-    auto options = parseOptions(argc, argv);
-    bool inputSpecified = false;
-    bool outputSpecified = false;
-    for (auto&& kv : options) {
-        ARG_CASE2("-f", "--format") {
-            CHECK_NUM_ARGS(1);
-            auto format = kv.second[0];
-            if (format == "bc1")  spec.format = DXGI_FORMAT_BC1_UNORM;
-            if (format == "bc3")  spec.format = DXGI_FORMAT_BC3_UNORM;
-            if (format == "bc5")  spec.format = DXGI_FORMAT_BC5_UNORM;
-            if (format == "bc6h") spec.format = DXGI_FORMAT_BC6H_UF16;
-            if (format == "bc7")  spec.format = DXGI_FORMAT_BC7_UNORM;
-            continue;
-        }
-        ARG_CASE2("-i", "--input") {
-            CHECK_NUM_ARGS(1);
-            inputSpecified = true;
-            spec.source = utf8ToUtf16(kv.second[0]);
-            continue;
-        }
-        ARG_CASE2("-l", "--linearColorSpace") {
-            spec.linearColorSpecified = true;
-            continue;
-        }
-        ARG_CASE2("-m", "--mipLevels") {
-            spec.mipmapSpecified = true;
-            if (kv.second.size() == 1)
-                spec.mipLevels = std::max(std::stoi(kv.second[0]), 0);
-            continue;
-        }
-        ARG_CASE2("-o", "--output") {
-            CHECK_NUM_ARGS(1);
-            outputSpecified = true;
-            spec.output = utf8ToUtf16(kv.second[0]);
-            continue;
-        }
-        ARG_CASE2("-q", "--quality") {
-            CHECK_NUM_ARGS(1);
-            auto level = kv.second[0];
-            if (level == "ultrafast") spec.level = Level::ULTRA_FAST;
-            if (level == "veryfast")  spec.level = Level::VERY_FAST;
-            if (level == "fast")      spec.level = Level::FAST;
-            if (level == "basic")     spec.level = Level::BASIC;
-            if (level == "slow")      spec.level = Level::SLOW;
-            if (level == "veryslow")  spec.level = Level::VERY_SLOW;
-            continue;
-        }
-        ARG_CASE2("--forceRgb", "--forcergb") {
-            spec.forceRgbSpecified = true;
-            continue;
-        }
-        ARG_CASE2("-v", "--verbose") {
-            spec.verboseSpecified = true;
-            continue;
-        }
-        ARG_CASE2("-h", "--help") {
-            ABORT(helpText);
-        }
-    }
-    if (!inputSpecified) ABORT("No input source specified! Use --input <filename/folder>, or see --help");
-    if (!outputSpecified) {
-        auto i = spec.source.find_last_of('/');
-        if (i != std::string::npos) {
-            spec.output = spec.source.substr(0, i) + spec.output;
-        }
-    }
-    return 0;
-}
-
-DXGI_FORMAT getTargetFormat(const Spec& spec) {
-    return spec.format != DXGI_FORMAT_BC6H_UF16 ? DXGI_FORMAT_R8G8B8A8_UNORM : DXGI_FORMAT_R16G16B16A16_FLOAT;
-}
-
-bool shouldConvertImage(const Spec& spec, const DirectX::TexMetadata& meta) {
-    return getTargetFormat(spec) != meta.format;
-}
-
-std::unique_ptr<DirectX::ScratchImage> loadImageFromFile(const Spec& spec) {
-    auto images = std::make_unique<DirectX::ScratchImage>();
-    DirectX::TexMetadata meta;
-    if (FAILED(DirectX::LoadFromDDSFile(spec.source.c_str(), DirectX::DDS_FLAGS_NONE, &meta, *images))) {
-        if (FAILED(DirectX::LoadFromTGAFile(spec.source.c_str(), &meta, *images))) {
-            if (FAILED(DirectX::LoadFromWICFile(spec.source.c_str(), DirectX::WIC_FLAGS_NONE, &meta, *images))) {
-                return nullptr;
-            }
-        }
-    }
-
-    // リニアカラー変換を指定されているが、画像のコンバートが必要ない場合。
-    // DirectX::Convertは元のフォーマットと変換後のフォーマットが同じ場合は失敗を返す。
-    // 色空間の変換のみを行うために、一度別のフォーマットに変更しておく。
-    if (spec.linearColorSpecified && !shouldConvertImage(spec, meta)) {
-        auto result = std::make_unique<DirectX::ScratchImage>();
-        if (FAILED(DirectX::Convert(images->GetImages(), images->GetImageCount(), images->GetMetadata(), DXGI_FORMAT_B8G8R8A8_UNORM, 
-                                    DirectX::TEX_FILTER_DEFAULT, DirectX::TEX_THRESHOLD_DEFAULT, *result))) {
-            return nullptr;
-        }
-        images = std::move(result);
-    }
-    return images;
-}
-
-std::unique_ptr<DirectX::ScratchImage> convertImage(const Spec& spec, std::unique_ptr<DirectX::ScratchImage> images) {
-    DXGI_FORMAT format = getTargetFormat(spec);
-    uint32_t filter = DirectX::TEX_FILTER_DEFAULT;
-    if (spec.linearColorSpecified) {
-        filter |= DirectX::TEX_FILTER_SRGB_IN;
-    }
-    auto result = std::make_unique<DirectX::ScratchImage>();
-    HRESULT hr = DirectX::Convert(images->GetImages(), images->GetImageCount(), images->GetMetadata(),
-                                  format, filter, DirectX::TEX_THRESHOLD_DEFAULT, *result);
-    if (FAILED(hr))
-        return nullptr;
-    return result;
-}
-
-std::unique_ptr<DirectX::ScratchImage> generateMipmaps(std::unique_ptr<DirectX::ScratchImage> images, uint32_t mipLevels) {
-    auto& meta = images->GetMetadata();
-    auto mipChain = std::make_unique<DirectX::ScratchImage>();
-    if (meta.dimension == DirectX::TEX_DIMENSION_TEXTURE3D) {
-        if (FAILED(DirectX::GenerateMipMaps3D(images->GetImages(), images->GetImageCount(), meta, DirectX::TEX_FILTER_DEFAULT, mipLevels, *mipChain))) {
-            return nullptr;
-        }
-    }
-    else {
-        if (FAILED(DirectX::GenerateMipMaps(images->GetImages(), images->GetImageCount(), meta, DirectX::TEX_FILTER_DEFAULT, mipLevels, *mipChain))) {
-            return nullptr;
-        }
-    }
-    return mipChain;
-}
-
-std::unique_ptr<DirectX::ScratchImage> createNewImage(DXGI_FORMAT format, const DirectX::TexMetadata& meta) {
-    auto newImages = std::make_unique<DirectX::ScratchImage>();
-    if (meta.dimension == DirectX::TEX_DIMENSION_TEXTURE1D) {
-        newImages->Initialize1D(format, meta.width, meta.arraySize, meta.mipLevels);
-    }
-    else if (meta.dimension == DirectX::TEX_DIMENSION_TEXTURE2D) {
-        if (meta.miscFlags & DirectX::TEX_MISC_TEXTURECUBE) {
-            newImages->InitializeCube(format, meta.width, meta.height, meta.arraySize / 6, meta.mipLevels);
-        }
-        else {
-            newImages->Initialize2D(format, meta.width, meta.height, meta.arraySize, meta.mipLevels);
-        }
-    }
-    else if (meta.dimension == DirectX::TEX_DIMENSION_TEXTURE3D) {
-        newImages->Initialize3D(format, meta.width, meta.height, meta.depth, meta.mipLevels);
-    }
-    return newImages;
-}
-
-void initBC6HProfile(bc6h_enc_settings* settings, Level::Type level) {
-    switch (level) {
-    case Level::ULTRA_FAST: GetProfile_bc6h_veryfast(settings); break;
-    case Level::VERY_FAST:  GetProfile_bc6h_veryfast(settings); break;
-    case Level::FAST:       GetProfile_bc6h_fast(settings); break;
-    case Level::BASIC:      GetProfile_bc6h_basic(settings); break;
-    case Level::SLOW:       GetProfile_bc6h_slow(settings); break;
-    case Level::VERY_SLOW:  GetProfile_bc6h_veryslow(settings); break;
-    default:
-        break;
-    }
-}
-
-void initBC7Profile(bc7_enc_settings* settings, Level::Type level, bool forceRgbSpecified) {
-    if (forceRgbSpecified) {
-        switch (level) {
-        case Level::ULTRA_FAST: GetProfile_ultrafast(settings); break;
-        case Level::VERY_FAST:  GetProfile_veryfast(settings); break;
-        case Level::FAST:       GetProfile_fast(settings); break;
-        case Level::BASIC:      GetProfile_basic(settings); break;
-        case Level::SLOW:       GetProfile_slow(settings); break;
-        case Level::VERY_SLOW:  GetProfile_slow(settings); break;
-        default:
-            break;
-        }
-    }
-    else {
-        switch (level) {
-        case Level::ULTRA_FAST: GetProfile_alpha_ultrafast(settings); break;
-        case Level::VERY_FAST:  GetProfile_alpha_veryfast(settings); break;
-        case Level::FAST:       GetProfile_alpha_fast(settings); break;
-        case Level::BASIC:      GetProfile_alpha_basic(settings); break;
-        case Level::SLOW:       GetProfile_alpha_slow(settings); break;
-        case Level::VERY_SLOW:  GetProfile_alpha_slow(settings); break;
-        default:
-            break;
-        }
-    }
-}
-
-std::unique_ptr<DirectX::ScratchImage> compressImages(std::unique_ptr<DirectX::ScratchImage> images, const Spec& spec) {
-    auto& meta = images->GetMetadata();
-    auto newImages = createNewImage(spec.format, meta);
-
-    util::Image image;
-
-    for (size_t mip = 0; mip < meta.mipLevels; ++mip) {
-        for (size_t item = 0; item < meta.arraySize; ++item) {
-            for (size_t slice = 0; slice < meta.depth; ++slice) {
-                auto src = images->GetImage(mip, item, slice);
-                auto dst = newImages->GetImage(mip, item, slice);
-
-                rgba_surface surface;
-                if ((src->width & 3) == 0 && (src->height & 3) == 0) {
-                    surface.ptr = src->pixels;
-                    surface.width = (int32_t)src->width;
-                    surface.height = (int32_t)src->height;
-                    surface.stride = (int32_t)src->rowPitch;
-                }
-                else {
-                    int32_t w = (int32_t)ROUNDUP(src->width, 4);
-                    int32_t h = (int32_t)ROUNDUP(src->height, 4);
-                    int32_t bpp = (int32_t)DirectX::BitsPerPixel(src->format);
-                    int32_t stride = (bpp >> 3) * w;
-                    image = util::Image(w, h, stride, bpp);
-
-                    util::Image temp;
-                    temp.set(src->pixels, src->width, src->height, src->rowPitch, bpp);
-                    image.copy(temp);
-
-                    surface.ptr = (uint8_t*)image.getData();
-                    surface.width = (int32_t)image.getWidth();
-                    surface.height = (int32_t)image.getHeight();
-                    surface.stride = (int32_t)image.getBytesPerRow();
-                }
-
-                switch (spec.format) {
-                  case DXGI_FORMAT_BC1_UNORM: {
-                    CompressBlocksBC1(&surface, dst->pixels);
-                    break;
-                  }
-                  case DXGI_FORMAT_BC3_UNORM: {
-                    CompressBlocksBC3(&surface, dst->pixels);
-                    break;
-                  }
-                  case DXGI_FORMAT_BC6H_UF16: {
-                    bc6h_enc_settings settings;
-                    initBC6HProfile(&settings, spec.level);
-                    CompressBlocksBC6H(&surface, dst->pixels, &settings);
-                    break;
-                  }
-                  case DXGI_FORMAT_BC7_UNORM: {
-                    bc7_enc_settings settings;
-                    initBC7Profile(&settings, spec.level, spec.forceRgbSpecified);
-                    CompressBlocksBC7(&surface, dst->pixels, &settings);
-                    break;
-                  }
-                }
-            }
-        }
-    }
-    return newImages;
-}
-
-std::unique_ptr<DirectX::ScratchImage> compressNormalMaps(std::unique_ptr<DirectX::ScratchImage> images, const Spec& spec) {
-    auto newImages = std::make_unique<DirectX::ScratchImage>();
-    if (FAILED(DirectX::Compress(images->GetImages(), images->GetImageCount(), images->GetMetadata(),
-                                 spec.format, DirectX::TEX_COMPRESS_DEFAULT, DirectX::TEX_THRESHOLD_DEFAULT,
-                                 *newImages)))
-    {
-        return nullptr;
-    }
-    return newImages;
-}
-
-}
-
-int main(int argc, char* argv[]) {
-    if (FAILED(CoInitializeEx(NULL, COINIT_MULTITHREADED)))
-        return 1;
-
-    Spec spec;
-    if (parseArguments(spec, argc, argv) != 0)
-        return 1;
-
-    auto images = loadImageFromFile(spec);
-    if (!images)
-        ABORT("DirectX::LoadFromXXXFile failed.");
-
-    if (shouldConvertImage(spec, images->GetMetadata())) {
-        images = convertImage(spec, std::move(images));
-        if (!images)
-            ABORT("DirectX::Convert failed.");
-    }
-
-    if (spec.mipmapSpecified) {
-        images = generateMipmaps(std::move(images), spec.mipLevels);
-        if (!images)
-            ABORT("DirectX::GenerateMipMaps failed.");
-    }
-
-    if (spec.format != DXGI_FORMAT_BC5_UNORM) {
-        images = compressImages(std::move(images), spec);
-    }
-    else {
-        images = compressNormalMaps(std::move(images), spec);
-        if (!images)
-            ABORT("DirectX::Compress failed.");
-    }
-
-    if (FAILED(DirectX::SaveToDDSFile(images->GetImages(), images->GetImageCount(), images->GetMetadata(),
-                                      DirectX::DDS_FLAGS_NONE, spec.output.c_str()))) {
-        ABORT("DirectX::SaveToDDSFile failed.");
-    }
-
-    CoUninitialize();
-    return 0;
-}
+﻿#include <cassert>
+#include <cstdint>
+#include <cwctype>
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#define _dup dup
+#define _dup2 dup2
+#define _fileno fileno
+#define _fdopen fdopen
+#endif
+
+#include "bounded_queue.h"
+#include "ispc_texcomp.h"
+#include "pipeline.h"
+#include "trace.h"
+
+#define ABORT(msg) { puts(msg); return 1; }
+#define ARG_CASE(s) if (kv.first == s)
+#define ARG_CASE2(s1, s2) if (kv.first == s1 || kv.first == s2)
+#define CHECK_NUM_ARGS(p) if (kv.second.size() < p) continue;
+
+namespace {
+
+using ddsconv::Job;
+using ddsconv::Level;
+using ddsconv::Spec;
+using ddsconv::Stage;
+using ddsconv::makeStages;
+using ddsconv::runStage;
+
+const char helpText[] = 
+    "\n"
+    "ddsconv v" VERSION "\n"
+    "---------------------------------------------------------------------\n"
+    "  Usage: ddsconv <input specification> <options>\n"
+    "\n"
+    "INPUT SPECIFICATION\n"
+    "  -i, --input <filename>\n"
+        "\t入力ファイルパスを指定します。\n"
+    "  --batch <manifest/folder>\n"
+        "\t複数のファイルを1つのプロセスでまとめて変換します。\n"
+        "\tフォルダを指定した場合は、フォルダ以下の画像ファイルをすべて変換します。\n"
+        "\tマニフェストには1行に1ファイルずつ、入力ファイルパスと個別のオプションを記述します。\n"
+        "\t  例: textures/albedo.png -f bc7 -q slow -m 0\n"
+        "\tコマンドラインのオプションは全ファイルの初期値となり、-oは出力フォルダの指定になります。\n"
+        "\t読み込み、変換、ミップマップ生成、圧縮、保存はファイルをまたいで並行して処理されます。\n"
+        "\t32x32ピクセル相当以下のサブリソースは、続くファイルのものとまとめて圧縮します。\n"
+        "\t-vを指定したファイルと、--refineで割合を指定したファイルはファイルごとにまとめます。\n"
+    "  --serve\n"
+        "\t常駐して標準入力から変換要求を受け取り、結果を標準出力に返します。\n"
+        "\tスレッドプールと作業領域を使い回すため、変換1件あたりの起動コストがかかりません。\n"
+        "\t要求は1行に1件で、マニフェストと同じく入力ファイルパスと個別のオプションを記述します。\n"
+        "\tコマンドラインのオプションは全要求の初期値になります。要求にのみ次のオプションを指定できます。\n"
+        "\t  --data <bytes>         改行の直後に続く<bytes>バイトを画像ファイルの内容として読み込みます。\n"
+        "\t  --raw <width> <height> 改行の直後に続くRGBA8のピクセルを読み込みます。\n"
+        "\t  --reply                DDSファイルを出力せず、内容を標準出力に返します。\n"
+        "\t応答は1件につき次のいずれかです。\n"
+        "\t  OK <output>            出力ファイルパス(UTF-8)。\n"
+        "\t  DATA <bytes>           改行の直後に<bytes>バイトのDDSファイルの内容が続きます。\n"
+        "\t  ERROR <message>        失敗した理由。\n"
+        "\t失敗した要求でも--data,--rawのデータは読み飛ばします。サイズが読み取れない場合はERRORを返して終了します。\n"
+        "\t-oを指定しない要求の出力先は--batchと同じです。\n"
+        "\t標準入力が閉じられると終了します。その他のメッセージは標準エラーに出力されます。\n"
+    "\n"
+    "OPTIONS\n"
+    "  -f, --format <format>\n"
+        "\t圧縮フォーマットを指定します。\n"
+        "\tbc1  - RGB画像、またはRGBA画像(1bitアルファ)。\n"
+        "\tbc3  - RGBA画像(多階調アルファ)。\n"
+        "\tbc4  - 1成分のデータ(マスクなど)。赤成分を使用します。DX10以降。\n"
+        "\tbc5  - 2成分のデータ(法線マップなど)。赤と緑成分を使用します。DX10以降。\n"
+        "\tbc6h - HDRのRGB画像。DX10以降。\n"
+        "\tbc7  - RGB画像、またはRGBA画像(多階調アルファ)。DX10以降。\n"
+    "  -h, --help\n"
+        "\tこれを表示します。\n"
+    "  -l, --linearColorSpace\n"
+        "\tsRGBカラー空間からリニアカラー空間へ変換します。\n"
+    "  -m, --miplevels <levels>\n"
+        "\t元画像を含むミップマップレベルを指定します。\n"
+        "\t0を指定した場合は1x1までのミップマップを出力します。\n"
+    "  -o, --output <filename>\n"
+        "\t出力ファイルパスを指定します。初期値は\"output.dds\"です。\n"
+    "  -q, --quality <level>\n"
+        "\tBC7/BC6Hの圧縮速度と品質を指定します。初期値は\"ultrafast\"です。\n"
+        "\tultrafast - 最高速度。\n"
+        "\tveryfast  - 非常に高速。\n"
+        "\tfast      - 高速。\n"
+        "\tbasic     - 中間。\n"
+        "\tslow      - 高品質。\n"
+        "\tveryslow  - 最高品質。\n"
+    "  --refine <psnr|percent%>\n"
+        "\tBC7とBC6Hで、まず全ブロックをveryfastで圧縮し、誤差の大きいブロックだけを-qの品質で圧縮し直します。\n"
+        "\t数値のみの場合はPSNR(dB)がそれを下回るブロック、%を付けた場合は誤差の大きい順にその割合のブロックが対象です。\n"
+        "\t割合はサブリソース(ミップレベル、配列の要素)ごとに全体の誤差から選びます。\n"
+        "\t圧縮し直した結果は誤差が減った場合のみ使います。BC6Hのpsnrはhalf floatのビット列に対する値です。\n"
+        "\t-qがveryfast以下の場合は無視されます。\n"
+    "  --forceRgb\n"
+        "\tBC7の圧縮時にアルファチャンネルを無視します。\n"
+        "\tわずかに圧縮速度が向上しますが、サイズには影響しません。\n"
+    "  --autoFormat\n"
+        "\t読み込んだ画像の全ピクセルを調べ、小さいか速い圧縮方法を自動で選びます。\n"
+        "\t不透明な画像はBC3ならBC1に、BC7ならRGBのプロファイル(--forceRgb)にします。\n"
+        "\t不透明なグレースケールはBC4、青が0の不透明な画像はBC5にします(BC1からはBC5にしません)。\n"
+        "\tBC4とBC5では成分の意味が変わります。BC4はRだけでGとBは0として、BC5はRとGだけで読み出されるので、\n"
+        "\tシェーダー側での対応が必要です。\n"
+        "\t-fがBC4,BC5,BC6Hの場合は無視され、--streamは無効になります。選んだ結果は-vで表示され、\n"
+        "\t--batchでは最後にBC4,BC5にしたファイルの一覧を表示します。\n"
+    "  --mipFilter <filter>\n"
+        "\tミップマップの生成に使用するフィルタを指定します。初期値は\"box\"です。\n"
+        "\tbox     - 2x2の平均。最高速度。\n"
+        "\tkaiser  - Kaiser窓付きsinc。シャープ。\n"
+        "\tlanczos - Lanczos3。シャープ。\n"
+        "\t2D画像とキューブマップでは各レベルを生成しながら圧縮し、ミップマップ全体を非圧縮で保持しません。\n"
+    "  --mipSrgb\n"
+        "\tミップマップの生成時にRGBをsRGBとみなし、リニアに変換してからフィルタリングします。\n"
+        "\t-lを指定した場合とBC6Hでは既にリニアなので無視されます。\n"
+    "  --cache <folder>\n"
+        "\t出力キャッシュのフォルダを指定します。\n"
+        "\t入力ファイルの内容と圧縮設定が同じ変換結果がキャッシュにある場合は、圧縮を行わずにそれを出力します。\n"
+    "  --stream\n"
+        "\t画像全体をメモリに展開せず、横長の帯単位で読み込みと圧縮、書き出しを行います。\n"
+        "\t非常に大きな画像のメモリ使用量を抑えられます。\n"
+        "\tWindowsでWICで読み込める2D画像をBC6H以外に変換する場合のみ有効で、ミップマップは生成できません。\n"
+        "\t--refineで割合を指定した場合も無効です。\n"
+        "\tそれ以外の場合は通常の変換を行います。\n"
+    "  --dedup\n"
+        "\t同じ4x4ブロックの圧縮結果を記録し、2回目以降は圧縮せずにコピーします。\n"
+        "\tタイル状のテクスチャや、--batchで似た画像を変換する場合にBC7とBC6Hの圧縮時間を短縮できます。\n"
+        "\t記録はスレッドと--batchのファイルの間で共有され、約100MBを上限とします。出力結果は変わりません。\n"
+        "\t--refineで割合を指定した場合は無視されます。\n"
+    "  --threads <count>\n"
+        "\t圧縮に使用するスレッド数を指定します。\n"
+        "\t0を指定した場合は論理コア数を使用します。初期値は0です。\n"
+        "\tスレッド数によって出力結果が変わることはありません。\n"
+    "  --isa <name>\n"
+        "\tBC1からBC7の圧縮に使うISPCのターゲットを指定します。初期値は\"auto\"です。\n"
+        "\tauto      - CPUが対応する最も幅の広いターゲットを実行時に選びます。\n"
+        "\tsse2, sse4, avx, avx2, avx512skx, neon - そのターゲットを使います。\n"
+        "\tビルドに含まれていないか、CPUが対応していない場合はエラーになります。比較やテストに使います。\n"
+    "  -v, --verbose\n"
+        "\t変換したファイルごとに、圧縮に使ったISPCのターゲット、段階ごとの処理時間、処理速度(MPix/s)、\n"
+        "\tメモリ使用量の最大値を表示します。\n"
+        "\t圧縮はサブリソースごとの内訳も表示します。ミップマップを圧縮と並行して生成する場合、\n"
+        "\t各レベルの生成時間は圧縮の内訳に含まれます。--batchでは段階が並行して動くため、時間は重なります。\n"
+        "\tBC7とBC6Hでは、モードとパーティションの選ばれた割合、1ブロックあたりの候補数と枝刈りされた数、\n"
+        "\t改善の反復回数などのエンコーダーの統計も表示します。統計を集計する分、圧縮は遅くなります。\n"
+        "\t--dedupでは、圧縮せずにコピーしたブロックの割合も表示します。\n"
+    "  --trace <file>\n"
+        "\t各段階とスレッドプールのタスクの区間を、Chrome trace-event形式のJSONで書き出します。\n"
+        "\tchrome://tracingやPerfettoで開けます。\n"
+    "\n";
+
+using Options = std::map<std::string, std::vector<std::string>>;
+
+Options parseOptions(int argc, char* argv[]) {
+    Options options;
+    int argPos = 1;
+    bool suggestHelp = false;
+    while (argPos < argc) {
+        const char* arg = argv[argPos];
+        if (arg[0] != '-') {
+            printf("Unknown setting or insufficient parameters: %s\n", arg);
+            suggestHelp = true;
+        }
+        else {
+            int pos = argPos;
+            while (pos+1 < argc) {
+                if (argv[pos+1][0] == '-') break;
+                ++pos;
+            }
+            int count = pos - argPos;
+            if (count <= 0) {
+                options[arg].clear();
+                ++argPos;
+            }
+            else {
+                for (int i = argPos+1, end = i+count; i < end; ++i)
+                    options[arg].push_back(argv[i]);
+                argPos += 1 + count;
+            }
+        }
+    }
+    if (suggestHelp) printf("Use --help for more information.\n");
+    return options;
+}
+
+#ifdef _WIN32
+
+std::wstring utf8ToUtf16(const std::string& u8str) {
+    int u16strLen = ::MultiByteToWideChar(CP_UTF8, 0, u8str.c_str(), -1, NULL, 0);
+    if (u16strLen <= 0) return std::wstring();
+    std::wstring u16str;
+    u16str.resize(static_cast<size_t>(u16strLen) - 1);
+    ::MultiByteToWideChar(CP_UTF8, 0, u8str.c_str(), -1, &u16str[0], u16strLen);
+    return u16str;
+}
+
+std::string utf16ToUtf8(const std::wstring& u16str) {
+    int u8strLen = ::WideCharToMultiByte(CP_UTF8, 0, u16str.c_str(), -1, NULL, 0, NULL, NULL);
+    if (u8strLen <= 0) return std::string();
+    std::string u8str;
+    u8str.resize(static_cast<size_t>(u8strLen) - 1);
+    ::WideCharToMultiByte(CP_UTF8, 0, u16str.c_str(), -1, &u8str[0], u8strLen, NULL, NULL);
+    return u8str;
+}
+
+#else
+
+std::wstring utf8ToUtf16(const std::string& u8str) {
+    return std::filesystem::u8path(u8str).wstring();
+}
+
+std::string utf16ToUtf8(const std::wstring& u16str) {
+    return std::filesystem::path(u16str).u8string();
+}
+
+#endif
+
+// WICで読み込むスレッドではCOMを初期化しておく。Windows以外では何もしない。
+bool initializeCom() {
+#ifdef _WIN32
+    return SUCCEEDED(CoInitializeEx(NULL, COINIT_MULTITHREADED));
+#else
+    return true;
+#endif
+}
+
+void uninitializeCom() {
+#ifdef _WIN32
+    CoUninitialize();
+#endif
+}
+
+int applyOptions(Spec& spec, const Options& options) {
+    for (auto&& kv : options) {
+        ARG_CASE2("-f", "--format") {
+            CHECK_NUM_ARGS(1);
+            auto format = kv.second[0];
+            if (format == "bc1")  spec.format = DXGI_FORMAT_BC1_UNORM;
+            if (format == "bc3")  spec.format = DXGI_FORMAT_BC3_UNORM;
+            if (format == "bc4")  spec.format = DXGI_FORMAT_BC4_UNORM;
+            if (format == "bc5")  spec.format = DXGI_FORMAT_BC5_UNORM;
+            if (format == "bc6h") spec.format = DXGI_FORMAT_BC6H_UF16;
+            if (format == "bc7")  spec.format = DXGI_FORMAT_BC7_UNORM;
+            continue;
+        }
+        ARG_CASE2("-i", "--input") {
+            CHECK_NUM_ARGS(1);
+            spec.source = utf8ToUtf16(kv.second[0]);
+            continue;
+        }
+        ARG_CASE("--batch") {
+            CHECK_NUM_ARGS(1);
+            spec.batch = utf8ToUtf16(kv.second[0]);
+            continue;
+        }
+        ARG_CASE2("-l", "--linearColorSpace") {
+            spec.linearColorSpecified = true;
+            continue;
+        }
+        ARG_CASE2("-m", "--mipLevels") {
+            spec.mipmapSpecified = true;
+            if (kv.second.size() == 1)
+                spec.mipLevels = std::max(std::stoi(kv.second[0]), 0);
+            continue;
+        }
+        ARG_CASE2("-o", "--output") {
+            CHECK_NUM_ARGS(1);
+            spec.outputSpecified = true;
+            spec.output = utf8ToUtf16(kv.second[0]);
+            continue;
+        }
+        ARG_CASE2("-q", "--quality") {
+            CHECK_NUM_ARGS(1);
+            auto level = kv.second[0];
+            if (level == "ultrafast") spec.level = Level::ULTRA_FAST;
+            if (level == "veryfast")  spec.level = Level::VERY_FAST;
+            if (level == "fast")      spec.level = Level::FAST;
+            if (level == "basic")     spec.level = Level::BASIC;
+            if (level == "slow")      spec.level = Level::SLOW;
+            if (level == "veryslow")  spec.level = Level::VERY_SLOW;
+            continue;
+        }
+        ARG_CASE("--refine") {
+            CHECK_NUM_ARGS(1);
+            auto value = kv.second[0];
+            if (!value.empty() && value.back() == '%')
+                spec.refinePercent = std::max(std::stof(value.substr(0, value.size() - 1)), 0.0f);
+            else
+                spec.refinePsnr = std::max(std::stof(value), 0.0f);
+            continue;
+        }
+        ARG_CASE2("--forceRgb", "--forcergb") {
+            spec.forceRgbSpecified = true;
+            continue;
+        }
+        ARG_CASE2("--autoFormat", "--autoformat") {
+            spec.autoFormatSpecified = true;
+            continue;
+        }
+        ARG_CASE2("--mipFilter", "--mipfilter") {
+            CHECK_NUM_ARGS(1);
+            auto filter = kv.second[0];
+            if (filter == "box")     spec.mipFilter = util::MipFilter::Box;
+            if (filter == "kaiser")  spec.mipFilter = util::MipFilter::Kaiser;
+            if (filter == "lanczos") spec.mipFilter = util::MipFilter::Lanczos;
+            continue;
+        }
+        ARG_CASE2("--mipSrgb", "--mipsrgb") {
+            spec.mipSrgbSpecified = true;
+            continue;
+        }
+        ARG_CASE("--cache") {
+            CHECK_NUM_ARGS(1);
+            spec.cacheDir = utf8ToUtf16(kv.second[0]);
+            continue;
+        }
+        ARG_CASE("--stream") {
+            spec.streamSpecified = true;
+            continue;
+        }
+        ARG_CASE("--serve") {
+            spec.serveSpecified = true;
+            continue;
+        }
+        ARG_CASE("--dedup") {
+            spec.dedupSpecified = true;
+            continue;
+        }
+        ARG_CASE("--threads") {
+            CHECK_NUM_ARGS(1);
+            spec.threads = (uint32_t)std::max(std::stoi(kv.second[0]), 0);
+            continue;
+        }
+        ARG_CASE("--isa") {
+            CHECK_NUM_ARGS(1);
+            spec.isa = kv.second[0];
+            continue;
+        }
+        ARG_CASE2("-v", "--verbose") {
+            spec.verboseSpecified = true;
+            continue;
+        }
+        ARG_CASE("--trace") {
+            CHECK_NUM_ARGS(1);
+            spec.trace = utf8ToUtf16(kv.second[0]);
+            continue;
+        }
+        ARG_CASE2("-h", "--help") {
+            ABORT(helpText);
+        }
+    }
+    return 0;
+}
+
+int parseArguments(Spec& spec, int argc, char* argv[]) {
+    if (applyOptions(spec, parseOptions(argc, argv)) != 0)
+        return 1;
+    if (!spec.batch.empty() || spec.serveSpecified)
+        return 0;
+    if (spec.source.empty()) ABORT("No input source specified! Use --input <filename/folder>, or see --help");
+    if (!spec.outputSpecified) {
+        auto i = spec.source.find_last_of('/');
+        if (i != std::string::npos) {
+            spec.output = spec.source.substr(0, i) + spec.output;
+        }
+    }
+    return 0;
+}
+
+// ステージ間のキューの容量。ステージあたりのメモリ使用量を抑えるため小さくしておく。
+const size_t kBatchQueueDepth = 2;
+
+bool isImageFile(const std::filesystem::path& path) {
+    static const wchar_t* const extensions[] = {
+        L".bmp", L".dds", L".gif", L".jpeg", L".jpg", L".png", L".tga", L".tif", L".tiff",
+    };
+    auto ext = path.extension().wstring();
+    std::transform(ext.begin(), ext.end(), ext.begin(), std::towlower);
+    for (auto e : extensions) {
+        if (ext == e) return true;
+    }
+    return false;
+}
+
+// マニフェストの1行を空白で区切る。ダブルクォートで囲まれた部分は1つの引数として扱う。
+std::vector<std::string> splitManifestLine(const std::string& line) {
+    std::vector<std::string> args;
+    std::string arg;
+    bool quoted = false;
+    bool hasArg = false;
+    for (char c : line) {
+        if (c == '"') {
+            quoted = !quoted;
+            hasArg = true;
+        }
+        else if (!quoted && (c == ' ' || c == '\t' || c == '\r')) {
+            if (hasArg) args.push_back(arg);
+            arg.clear();
+            hasArg = false;
+        }
+        else {
+            arg.push_back(c);
+            hasArg = true;
+        }
+    }
+    if (hasArg) args.push_back(arg);
+    return args;
+}
+
+std::filesystem::path getBatchOutputPath(const Spec& base, const std::filesystem::path& source,
+                                         const std::filesystem::path& relativeDir) {
+    auto dir = base.outputSpecified ? std::filesystem::path(base.output) / relativeDir : source.parent_path();
+    return dir / source.stem().concat(L".dds");
+}
+
+// マニフェストまたはフォルダから変換するファイルの一覧を作成する。
+int collectBatchSpecs(const Spec& base, std::vector<Spec>& specs) {
+    std::error_code ec;
+    std::filesystem::path batch(base.batch);
+    if (std::filesystem::is_directory(batch, ec)) {
+        std::vector<std::filesystem::path> files;
+        for (auto& entry : std::filesystem::recursive_directory_iterator(batch, ec)) {
+            if (entry.is_regular_file(ec) && isImageFile(entry.path()))
+                files.push_back(entry.path());
+        }
+        std::sort(files.begin(), files.end());
+        for (auto& file : files) {
+            Spec spec = base;
+            spec.source = file.wstring();
+            spec.output = getBatchOutputPath(base, file, file.parent_path().lexically_relative(batch)).wstring();
+            specs.push_back(spec);
+        }
+        return 0;
+    }
+
+    std::ifstream manifest(batch);
+    if (!manifest) ABORT("Failed to open the batch manifest.");
+
+    // マニフェスト内の相対パスはマニフェストのあるフォルダを基準にする。
+    auto manifestDir = batch.parent_path();
+    std::string line;
+    while (std::getline(manifest, line)) {
+        auto args = splitManifestLine(line);
+        if (args.empty() || args[0][0] == '#') continue;
+
+        Spec spec = base;
+        spec.source.clear();
+        spec.outputSpecified = false;
+        if (args[0][0] != '-') {
+            args.insert(args.begin(), "--input");
+        }
+        std::vector<char*> argv(1, nullptr);
+        for (auto& arg : args)
+            argv.push_back(&arg[0]);
+        if (applyOptions(spec, parseOptions((int)argv.size(), argv.data())) != 0)
+            return 1;
+        if (spec.source.empty()) {
+            printf("No input source specified in the batch manifest: %s\n", line.c_str());
+            return 1;
+        }
+
+        auto source = manifestDir / spec.source;
+        spec.source = source.wstring();
+        if (spec.outputSpecified) {
+            spec.output = (manifestDir / spec.output).wstring();
+        }
+        else {
+            spec.output = getBatchOutputPath(base, source, std::filesystem::path()).wstring();
+        }
+        specs.push_back(spec);
+    }
+    return 0;
+}
+
+// --verboseで記録した段階ごとの処理時間とエンコーダーの統計を表示する。
+void printTimings(const Job& job) {
+    printf("%s\n", job.spec.source.empty() ? "(memory)" : utf16ToUtf8(job.spec.source).c_str());
+    printf("  ISA: %s\n", GetTargetISA());
+    for (auto& timing : job.timings) {
+        printf("  %s%-*s %10.2f ms", timing.detail ? "  " : "", timing.detail ? 18 : 20, timing.name.c_str(), timing.seconds * 1e3);
+        if (timing.pixels > 0 && timing.seconds > 0)
+            printf(" %10.2f MPix/s", timing.pixels / timing.seconds / 1e6);
+        else
+            printf(" %17s", "-");
+        if (!timing.detail)
+            printf("  peak %8.1f MB", timing.peakBytes / (1024.0 * 1024.0));
+        printf("\n");
+    }
+    if (!job.analysis.empty())
+        printf("  %s\n", job.analysis.c_str());
+    for (auto& line : job.encoderStats)
+        printf("  %s\n", line.c_str());
+}
+
+// 読み込みから保存までの各段階を別々のスレッドで実行し、
+// 前のファイルの圧縮や保存と次のファイルの読み込みを重ねて処理する。
+// 各段階がスレッドプールで待つのは自分のジョブのタスク(TaskGroup)だけなので、
+// 変換やミップマップの生成も前のファイルの圧縮の完了を待たずに進む。
+// 小さいサブリソースは続くファイルのものとまとめて圧縮し、保存の段階でその完了を待つ。
+int runBatch(util::ThreadPool& pool, const std::vector<Spec>& specs) {
+    const auto stages = makeStages(pool, true);
+    using JobQueue = util::BoundedQueue<std::unique_ptr<Job>>;
+
+    std::vector<std::unique_ptr<JobQueue>> queues;
+    for (size_t i = 1; i < stages.size(); ++i)
+        queues.push_back(std::make_unique<JobQueue>(kBatchQueueDepth));
+
+    std::atomic<int> failed{0};
+    // --autoFormatでBC4,BC5にしたファイル。最後の段階のスレッドだけが追加する。
+    std::vector<std::string> channelChanges;
+    std::vector<std::thread> threads;
+    for (size_t stage = 0; stage < stages.size(); ++stage) {
+        threads.emplace_back([&, stage] {
+            util::Tracer::get().setThreadName(std::string("stage ") + stages[stage].name);
+            bool comInitialized = initializeCom();
+            bool lastStage = stage + 1 == stages.size();
+            size_t next = 0;
+            for (;;) {
+                std::unique_ptr<Job> job;
+                if (stage == 0) {
+                    if (next >= specs.size()) break;
+                    job = std::make_unique<Job>();
+                    job->spec = specs[next++];
+                }
+                else if (!queues[stage - 1]->pop(job)) {
+                    break;
+                }
+
+                // 失敗したファイルも最後のステージまで流して、結果を順番通りに報告する。
+                if (!job->error && !job->finished) job->error = runStage(stages[stage], *job);
+                if (!lastStage) {
+                    queues[stage]->push(std::move(job));
+                    continue;
+                }
+                if (job->spec.verboseSpecified) {
+                    printTimings(*job);
+                    auto format = job->spec.format;
+                    if (!job->error && !job->analysis.empty() &&
+                        (format == DXGI_FORMAT_BC4_UNORM || format == DXGI_FORMAT_BC5_UNORM)) {
+                        channelChanges.push_back(std::string(format == DXGI_FORMAT_BC4_UNORM ? "BC4 " : "BC5 ") +
+                                                 utf16ToUtf8(job->spec.source));
+                    }
+                }
+                if (job->error) {
+                    printf("%s: %s\n", utf16ToUtf8(job->spec.source).c_str(), job->error);
+                    ++failed;
+                }
+            }
+            if (!lastStage) queues[stage]->close();
+            if (comInitialized) uninitializeCom();
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    if (!channelChanges.empty()) {
+        printf("--autoFormat changed the channels of %zu files (BC4: R only, BC5: R and G only):\n", channelChanges.size());
+        for (auto& line : channelChanges)
+            printf("  %s\n", line.c_str());
+    }
+
+    if (failed > 0) {
+        printf("%d of %zu files failed.\n", failed.load(), specs.size());
+        return 1;
+    }
+    return 0;
+}
+
+// --serveの要求を1行読み込む。標準入力が閉じられた場合はfalseを返す。
+bool readRequestLine(FILE* in, std::string& line) {
+    line.clear();
+    int c;
+    while ((c = fgetc(in)) != EOF) {
+        if (c == '\n') return true;
+        line.push_back((char)c);
+    }
+    return !line.empty();
+}
+
+// 文字列全体が10進数の場合のみvalueに設定する。
+bool parseSize(const std::string& text, uint64_t& value) {
+    if (text.empty() || text.size() > 19) return false;
+    value = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9') return false;
+        value = value * 10 + (uint64_t)(c - '0');
+    }
+    return true;
+}
+
+// 続くデータをpayloadに読み込む。確保できない場合も読み飛ばしてfalseを返す。
+bool readPayload(FILE* in, uint64_t size, std::vector<uint8_t>& payload, bool& closeSession) {
+    bool allocated = size <= SIZE_MAX;
+    if (allocated) {
+        try {
+            payload.resize((size_t)size);
+        }
+        catch (const std::exception&) {
+            allocated = false;
+        }
+    }
+    if (!allocated) {
+        payload.clear();
+        uint8_t buffer[65536];
+        for (uint64_t left = size; left > 0;) {
+            size_t n = (size_t)std::min<uint64_t>(left, sizeof(buffer));
+            if (fread(buffer, 1, n, in) != n) {
+                closeSession = true;
+                break;
+            }
+            left -= n;
+        }
+        return false;
+    }
+    if (fread(payload.data(), 1, payload.size(), in) != payload.size())
+        closeSession = true;
+    return !closeSession;
+}
+
+// 要求の引数からジョブを作成し、続くデータをpayloadに読み込む。--replyの場合、出力はoutputDataに書き込まれる。
+// 失敗した場合はエラーメッセージを返す。続くデータは、ほかの検証で失敗した場合も必ず読み切る。
+// データのサイズが分からず次の要求の位置が決まらない場合は、closeSessionを設定する。
+const char* readServeRequest(FILE* in, const Spec& base, std::vector<std::string> args,
+    std::vector<uint8_t>& payload, std::vector<uint8_t>& outputData, Job& job, bool& closeSession) {
+    job.spec = base;
+    job.spec.source.clear();
+    job.spec.outputSpecified = false;
+    job.spec.serveSpecified = false;
+    if (args[0][0] != '-') {
+        args.insert(args.begin(), "--input");
+    }
+    std::vector<char*> argv(1, nullptr);
+    for (auto& arg : args)
+        argv.push_back(&arg[0]);
+    auto options = parseOptions((int)argv.size(), argv.data());
+
+    // 要求にのみ指定できるオプション。続くデータのサイズが決まるので、ほかのオプションより先に処理する。
+    uint64_t payloadSize = 0;
+    auto data = options.find("--data");
+    if (data != options.end()) {
+        if (data->second.empty() || !parseSize(data->second[0], payloadSize)) {
+            closeSession = true;
+            return "--data requires the size of the image data.";
+        }
+        options.erase(data);
+    }
+    auto raw = options.find("--raw");
+    bool hasRaw = raw != options.end();
+    uint64_t rawWidth = 0, rawHeight = 0;
+    if (hasRaw) {
+        if (raw->second.size() < 2 || !parseSize(raw->second[0], rawWidth) || !parseSize(raw->second[1], rawHeight) ||
+            rawWidth > UINT32_MAX || rawHeight > UINT32_MAX || rawWidth * rawHeight > UINT64_MAX / 4) {
+            closeSession = true;
+            return "--raw requires the width and height of the pixels.";
+        }
+        payloadSize = rawWidth * rawHeight * 4;
+        options.erase(raw);
+    }
+
+    // ここから先で失敗しても、次の要求の前にデータを読み切っておく。
+    if (payloadSize > 0) {
+        if (!readPayload(in, payloadSize, payload, closeSession))
+            return closeSession ? "Failed to read the image data." : "The image data is too large.";
+        job.sourceData = payload.data();
+        job.sourceSize = payload.size();
+    }
+    if (hasRaw) {
+        if (rawWidth == 0 || rawHeight == 0) return "Invalid size for --raw.";
+        job.rawWidth = (uint32_t)rawWidth;
+        job.rawHeight = (uint32_t)rawHeight;
+        job.rawRowPitch = (size_t)rawWidth * 4;
+    }
+
+    auto reply = options.find("--reply");
+    if (reply != options.end()) {
+        job.allocateOutput = [&outputData](size_t size) {
+            outputData.resize(size);
+            return outputData.data();
+        };
+        options.erase(reply);
+    }
+
+    if (applyOptions(job.spec, options) != 0)
+        return "Invalid options.";
+    if (job.spec.source.empty() && !job.sourceData)
+        return "No input source specified.";
+    if (!job.allocateOutput && !job.spec.outputSpecified) {
+        if (job.spec.source.empty()) return "Specify -o or --reply for in-memory input.";
+        job.spec.output = getBatchOutputPath(base, job.spec.source, std::filesystem::path()).wstring();
+    }
+    return nullptr;
+}
+
+// 常駐して標準入力から要求を受け取り、1件ずつ変換して標準出力に応答する。
+// スレッドプールとスレッドごとの作業領域は要求をまたいで使い回す。
+int runServer(util::ThreadPool& pool, const Spec& base) {
+    // 応答用に標準出力を複製し、以降のprintfなどは標準エラーに出力されるようにする。
+    fflush(stdout);
+    int replyFd = _dup(_fileno(stdout));
+    if (replyFd < 0 || _dup2(_fileno(stderr), _fileno(stdout)) != 0)
+        ABORT("Failed to redirect the standard output.");
+    FILE* out = _fdopen(replyFd, "wb");
+    if (!out)
+        ABORT("Failed to open the standard output.");
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+
+    const auto stages = makeStages(pool);
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> outputData;
+    std::string line;
+    while (readRequestLine(stdin, line)) {
+        auto args = splitManifestLine(line);
+        if (args.empty() || args[0][0] == '#') continue;
+
+        // payloadとoutputDataは前の要求で確保した領域を使い回す。
+        Job job;
+        bool closeSession = false;
+        try {
+            job.error = readServeRequest(stdin, base, args, payload, outputData, job, closeSession);
+            for (auto& stage : stages) {
+                if (job.error || job.finished) break;
+                job.error = runStage(stage, job);
+            }
+        }
+        catch (const std::exception&) {
+            job.error = "Invalid request.";
+        }
+        // 標準出力は標準エラーに付け替えてあるので、応答とは混ざらない。
+        if (job.spec.verboseSpecified)
+            printTimings(job);
+
+        if (job.error) {
+            fprintf(out, "ERROR %s\n", job.error);
+        }
+        else if (job.allocateOutput) {
+            fprintf(out, "DATA %zu\n", job.outputSize);
+            fwrite(job.outputData, 1, job.outputSize, out);
+        }
+        else {
+            fprintf(out, "OK %s\n", utf16ToUtf8(job.spec.output).c_str());
+        }
+        fflush(out);
+        if (closeSession)
+            break;
+    }
+    fclose(out);
+    return 0;
+}
+
+// 1ファイルを変換する。
+int runSingle(util::ThreadPool& pool, const Spec& spec) {
+    Job job;
+    job.spec = spec;
+    for (auto& stage : makeStages(pool)) {
+        if (job.error || job.finished) break;
+        job.error = runStage(stage, job);
+    }
+    if (spec.verboseSpecified)
+        printTimings(job);
+    if (job.error)
+        ABORT(job.error);
+    return 0;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    if (!initializeCom())
+        return 1;
+
+    Spec spec;
+    if (parseArguments(spec, argc, argv) != 0)
+        return 1;
+
+    if (!spec.isa.empty() && !SetTargetISA(spec.isa.c_str())) {
+        printf("ISA \"%s\" is not available. Compiled targets: %s\n", spec.isa.c_str(), GetCompiledISAs());
+        return 1;
+    }
+
+    if (!spec.trace.empty()) {
+        util::Tracer::get().setThreadName("main");
+        util::Tracer::get().start();
+    }
+
+    int result;
+    {
+        util::ThreadPool pool(spec.threads);
+        if (spec.serveSpecified) {
+            result = runServer(pool, spec);
+        }
+        else if (!spec.batch.empty()) {
+            std::vector<Spec> specs;
+            result = collectBatchSpecs(spec, specs);
+            if (result == 0)
+                result = runBatch(pool, specs);
+        }
+        else {
+            result = runSingle(pool, spec);
+        }
+    }
+
+    if (!spec.trace.empty() && !util::Tracer::get().write(spec.trace)) {
+        printf("Failed to write the trace file.\n");
+        result = 1;
+    }
+    uninitializeCom();
+    return result;
+}
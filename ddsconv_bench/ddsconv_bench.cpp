@@ -0,0 +1,742 @@
+﻿#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#endif
+
+#include "DirectXTex.h"
+#include "ispc_texcomp.h"
+#include "color_convert.h"
+#include "libddsconv.h"
+#include "pipeline.h"
+#include "thread_pool.h"
+
+// ビルドに含まれるISPCのターゲット。CMakeではDDSCONV_ISPC_TARGETSから設定される。
+#ifndef DDSCONV_ISPC_TARGETS
+#define DDSCONV_ISPC_TARGETS "sse2,sse4,avx,avx2,avx512skx"
+#endif
+
+#define ABORT(msg) { puts(msg); return 1; }
+#define ROUNDUP(x,n) ((((x)+(n)-1)/(n))*(n))
+
+namespace {
+
+const char* kHelp =
+    "ddsconv_bench v" VERSION "\n"
+    "\n"
+    "使い方:\n"
+    "  ddsconv_bench [options]\n"
+    "\n"
+    "  すべての圧縮フォーマットとプロファイルの組み合わせで、生成画像とコーパスの画像を圧縮し、\n"
+    "  速度(MPix/s)、段階ごとの時間、PSNRを出力します。\n"
+    "  カーネル単体の計測に加え、libddsconvを通した変換全体の計測も行います。\n"
+    "\n"
+    "オプション:\n"
+    "  --corpus <folder>\n"
+    "\tフォルダ内の画像ファイルを入力に加えます。\n"
+    "  --json <file>\n"
+    "\t結果をJSONで書き出します。\n"
+    "  --format <list>\n"
+    "\t計測するフォーマットをカンマ区切りで指定します。初期値はすべてです。\n"
+    "\tbc1, bc3, bc4, bc5, bc6h, bc7, etc1, astc\n"
+    "  --profile <text>\n"
+    "\t名前にtextを含むプロファイルと品質だけを計測します。\n"
+    "  --size <pixels>\n"
+    "\t生成画像の幅と高さを指定します。初期値は1024です。\n"
+    "  --noGenerated\n"
+    "\t生成画像を使用しません。\n"
+    "  --noPipeline\n"
+    "\tlibddsconvを通した計測を行いません。\n"
+    "  --iterations <count>\n"
+    "\t各組み合わせの圧縮回数を指定します。最短の時間を結果とします。初期値は3です。\n"
+    "  --threads <count>\n"
+    "\t圧縮に使用するスレッド数を指定します。0はハードウェアスレッド数です。\n"
+    "  --isa <name>\n"
+    "\tISPCのターゲットを指定します。初期値は\"auto\"(実行時のディスパッチ)です。\n"
+    "\tsse2, sse4, avx, avx2, avx512skx, neonのうちビルドに含まれCPUが対応するもの\n"
+    "  -h, --help\n"
+    "\tヘルプを表示します。\n"
+    "\n"
+    "ISPCのターゲットを固定して比較する場合は--isaを指定してください。ASTCは常に実行時のディスパッチを使います。\n"
+    "結果には計測したビルドのターゲットと、使用したターゲットが記録されます。\n";
+
+struct Options {
+    std::filesystem::path corpus;
+    std::filesystem::path json;
+    std::vector<std::string> formats;
+    std::string profile;
+    uint32_t size = 1024;
+    uint32_t iterations = 3;
+    uint32_t threads = 0;
+    std::string isa;
+    bool generated = true;
+    bool pipeline = true;
+};
+
+// 計測に使う入力画像。LDRはRGBA8、HDRはRGBA16Fで、行の間に隙間はない。
+struct Source {
+    std::string name;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    bool hdr = false;
+    std::vector<uint8_t> pixels;
+    // コーパスの場合は元のファイルの内容。libddsconvを通した計測に使う。
+    std::vector<uint8_t> file;
+    double loadSeconds = 0;
+};
+
+// フォーマットとプロファイルの組み合わせ1つ分。
+struct Encoder {
+    std::string format;
+    std::string profile;
+    uint32_t blockWidth = 4;
+    uint32_t blockHeight = 4;
+    size_t blockBytes = 16;
+    // PSNRの計算に使うチャンネル数。BC4はR、BC5はRGのみ。
+    int channels = 3;
+    bool hdr = false;
+    // DirectXTexで展開できない場合はDXGI_FORMAT_UNKNOWN。
+    DXGI_FORMAT dxgiFormat = DXGI_FORMAT_UNKNOWN;
+    std::function<void(const rgba_surface*, uint8_t*)> compress;
+};
+
+struct KernelResult {
+    std::string source;
+    std::string format;
+    std::string profile;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    double prepareSeconds = 0;
+    double compressSeconds = 0;
+    double decodeSeconds = 0;
+    double psnr = -1;   // 計算できない場合は負の値
+};
+
+struct PipelineResult {
+    std::string source;
+    std::string format;
+    std::string quality;
+    uint32_t width;
+    uint32_t height;
+    double seconds;
+    size_t outputSize;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    size_t begin = 0;
+    while (begin <= text.size()) {
+        size_t end = text.find(',', begin);
+        if (end == std::string::npos) end = text.size();
+        if (end > begin) items.push_back(text.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return items;
+}
+
+int parseArguments(Options& options, int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-h" || arg == "--help") {
+            printf("%s", kHelp);
+            return 1;
+        }
+        else if (arg == "--corpus" && hasValue) options.corpus = std::filesystem::u8path(argv[++i]);
+        else if (arg == "--json" && hasValue) options.json = std::filesystem::u8path(argv[++i]);
+        else if (arg == "--format" && hasValue) options.formats = splitList(argv[++i]);
+        else if (arg == "--profile" && hasValue) options.profile = argv[++i];
+        else if (arg == "--size" && hasValue) options.size = (uint32_t)std::max(std::stoi(argv[++i]), 8);
+        else if (arg == "--iterations" && hasValue) options.iterations = (uint32_t)std::max(std::stoi(argv[++i]), 1);
+        else if (arg == "--threads" && hasValue) options.threads = (uint32_t)std::max(std::stoi(argv[++i]), 0);
+        else if (arg == "--isa" && hasValue) options.isa = argv[++i];
+        else if (arg == "--noGenerated") options.generated = false;
+        else if (arg == "--noPipeline") options.pipeline = false;
+        else {
+            printf("Invalid option: %s\nUse --help for more information.\n", arg.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
+
+bool isFormatSelected(const Options& options, const std::string& format) {
+    return options.formats.empty() || std::find(options.formats.begin(), options.formats.end(), format) != options.formats.end();
+}
+
+bool isProfileSelected(const Options& options, const std::string& profile) {
+    return options.profile.empty() || profile.find(options.profile) != std::string::npos;
+}
+
+// 生成画像。圧縮の難しさが異なるものを揃えておく。
+std::vector<Source> generateSources(uint32_t size) {
+    std::vector<Source> sources;
+    auto add = [&](const char* name, bool hdr, auto&& pixel) {
+        Source source;
+        source.name = name;
+        source.width = size;
+        source.height = size;
+        source.hdr = hdr;
+        source.pixels.resize((size_t)size * size * (hdr ? 8 : 4));
+        for (uint32_t y = 0; y < size; ++y) {
+            for (uint32_t x = 0; x < size; ++x) {
+                float rgba[4];
+                pixel(x, y, rgba);
+                size_t i = (size_t)y * size + x;
+                for (int c = 0; c < 4; ++c) {
+                    if (hdr)
+                        reinterpret_cast<uint16_t*>(source.pixels.data())[i * 4 + c] = util::floatToHalf(rgba[c]);
+                    else
+                        source.pixels[i * 4 + c] = (uint8_t)std::lround(std::min(std::max(rgba[c], 0.0f), 1.0f) * 255.0f);
+                }
+            }
+        }
+        sources.push_back(std::move(source));
+    };
+
+    // 乱数の種を固定して、実行ごとに同じ画像にする。
+    std::mt19937 random(12345);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    float inv = 1.0f / (float)(size - 1);
+
+    add("noise", false, [&](uint32_t, uint32_t, float* rgba) {
+        rgba[0] = unit(random); rgba[1] = unit(random); rgba[2] = unit(random); rgba[3] = 1.0f;
+    });
+    add("gradient", false, [&](uint32_t x, uint32_t y, float* rgba) {
+        rgba[0] = x * inv; rgba[1] = y * inv; rgba[2] = 1.0f - (x + y) * inv * 0.5f; rgba[3] = 1.0f;
+    });
+    add("flat", false, [&](uint32_t, uint32_t, float* rgba) {
+        rgba[0] = 0.25f; rgba[1] = 0.5f; rgba[2] = 0.75f; rgba[3] = 1.0f;
+    });
+    add("alpha", false, [&](uint32_t x, uint32_t y, float* rgba) {
+        // 同心円状のアルファと、ブロックごとに変わる色。
+        float dx = x * inv - 0.5f, dy = y * inv - 0.5f;
+        float r = std::sqrt(dx * dx + dy * dy);
+        rgba[0] = ((x >> 3) & 1) ? 0.9f : 0.1f;
+        rgba[1] = ((y >> 3) & 1) ? 0.8f : 0.3f;
+        rgba[2] = r;
+        rgba[3] = 0.5f + 0.5f * std::cos(r * 40.0f);
+    });
+    add("hdr", true, [&](uint32_t x, uint32_t y, float* rgba) {
+        float e = std::exp2(x * inv * 8.0f - 4.0f);
+        rgba[0] = e; rgba[1] = e * (0.5f + 0.5f * y * inv); rgba[2] = e * 0.25f + unit(random) * 0.05f; rgba[3] = 1.0f;
+    });
+    return sources;
+}
+
+// コーパスの画像を読み込み、浮動小数点のフォーマットはRGBA16F、それ以外はRGBA8に変換する。
+bool loadSource(const std::filesystem::path& path, Source& source) {
+    auto start = Clock::now();
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) return false;
+    source.file.resize((size_t)file.tellg());
+    file.seekg(0);
+    if (!file.read((char*)source.file.data(), (std::streamsize)source.file.size()))
+        return false;
+
+    DirectX::TexMetadata meta;
+    DirectX::ScratchImage images;
+    if (!ddsconv::loadImageFromMemory(source.file.data(), source.file.size(), meta, images))
+        return false;
+
+    source.name = path.filename().u8string();
+    source.hdr = DirectX::FormatDataType(meta.format) == DirectX::FORMAT_TYPE_FLOAT;
+    DXGI_FORMAT format = source.hdr ? DXGI_FORMAT_R16G16B16A16_FLOAT : DXGI_FORMAT_R8G8B8A8_UNORM;
+    auto image = images.GetImage(0, 0, 0);
+    DirectX::ScratchImage converted;
+    if (DirectX::IsCompressed(meta.format)) {
+        if (FAILED(DirectX::Decompress(*image, format, converted))) return false;
+        image = converted.GetImage(0, 0, 0);
+    }
+    else if (meta.format != format) {
+        if (FAILED(DirectX::Convert(*image, format, DirectX::TEX_FILTER_DEFAULT, DirectX::TEX_THRESHOLD_DEFAULT, converted))) return false;
+        image = converted.GetImage(0, 0, 0);
+    }
+
+    source.width = (uint32_t)image->width;
+    source.height = (uint32_t)image->height;
+    size_t rowBytes = image->width * (source.hdr ? 8 : 4);
+    source.pixels.resize(rowBytes * image->height);
+    for (size_t y = 0; y < image->height; ++y)
+        memcpy(source.pixels.data() + y * rowBytes, image->pixels + y * image->rowPitch, rowBytes);
+    source.loadSeconds = secondsSince(start);
+    return true;
+}
+
+std::vector<Encoder> makeEncoders() {
+    std::vector<Encoder> encoders;
+    auto add = [&](const char* format, std::string profile, DXGI_FORMAT dxgiFormat, size_t blockBytes, int channels,
+                   std::function<void(const rgba_surface*, uint8_t*)> compress) {
+        Encoder encoder;
+        encoder.format = format;
+        encoder.profile = std::move(profile);
+        encoder.dxgiFormat = dxgiFormat;
+        encoder.blockBytes = blockBytes;
+        encoder.channels = channels;
+        encoder.hdr = dxgiFormat == DXGI_FORMAT_BC6H_UF16;
+        encoder.compress = std::move(compress);
+        encoders.push_back(std::move(encoder));
+    };
+
+    add("bc1", "default", DXGI_FORMAT_BC1_UNORM, 8, 3, CompressBlocksBC1);
+    add("bc3", "default", DXGI_FORMAT_BC3_UNORM, 16, 4, CompressBlocksBC3);
+    add("bc4", "default", DXGI_FORMAT_BC4_UNORM, 8, 1, CompressBlocksBC4);
+    add("bc5", "default", DXGI_FORMAT_BC5_UNORM, 16, 2, CompressBlocksBC5);
+
+    const std::pair<const char*, void (*)(bc6h_enc_settings*)> bc6hProfiles[] = {
+        { "veryfast", GetProfile_bc6h_veryfast },
+        { "fast",     GetProfile_bc6h_fast },
+        { "basic",    GetProfile_bc6h_basic },
+        { "slow",     GetProfile_bc6h_slow },
+        { "veryslow", GetProfile_bc6h_veryslow },
+    };
+    for (auto& profile : bc6hProfiles) {
+        bc6h_enc_settings settings;
+        profile.second(&settings);
+        add("bc6h", profile.first, DXGI_FORMAT_BC6H_UF16, 16, 3, [settings](const rgba_surface* src, uint8_t* dst) mutable {
+            CompressBlocksBC6H(src, dst, &settings);
+        });
+    }
+
+    const std::pair<const char*, void (*)(bc7_enc_settings*)> bc7Profiles[] = {
+        { "ultrafast",       GetProfile_ultrafast },
+        { "veryfast",        GetProfile_veryfast },
+        { "fast",            GetProfile_fast },
+        { "basic",           GetProfile_basic },
+        { "slow",            GetProfile_slow },
+        { "alpha_ultrafast", GetProfile_alpha_ultrafast },
+        { "alpha_veryfast",  GetProfile_alpha_veryfast },
+        { "alpha_fast",      GetProfile_alpha_fast },
+        { "alpha_basic",     GetProfile_alpha_basic },
+        { "alpha_slow",      GetProfile_alpha_slow },
+    };
+    for (auto& profile : bc7Profiles) {
+        bc7_enc_settings settings;
+        profile.second(&settings);
+        int channels = strncmp(profile.first, "alpha", 5) == 0 ? 4 : 3;
+        add("bc7", profile.first, DXGI_FORMAT_BC7_UNORM, 16, channels, [settings](const rgba_surface* src, uint8_t* dst) mutable {
+            CompressBlocksBC7(src, dst, &settings);
+        });
+    }
+
+    etc_enc_settings etc;
+    GetProfile_etc_slow(&etc);
+    add("etc1", "slow", DXGI_FORMAT_UNKNOWN, 8, 3, [etc](const rgba_surface* src, uint8_t* dst) mutable {
+        CompressBlocksETC1(src, dst, &etc);
+    });
+
+    // ISPCのASTCエンコーダは8x8までのブロックに対応している。
+    const std::pair<int, int> astcBlocks[] = { {4, 4}, {5, 4}, {5, 5}, {6, 5}, {6, 6}, {8, 5}, {8, 6}, {8, 8} };
+    const std::pair<const char*, void (*)(astc_enc_settings*, int, int)> astcProfiles[] = {
+        { "fast",       GetProfile_astc_fast },
+        { "alpha_fast", GetProfile_astc_alpha_fast },
+        { "alpha_slow", GetProfile_astc_alpha_slow },
+    };
+    for (auto& block : astcBlocks) {
+        for (auto& profile : astcProfiles) {
+            astc_enc_settings settings;
+            profile.second(&settings, block.first, block.second);
+            int channels = strncmp(profile.first, "alpha", 5) == 0 ? 4 : 3;
+            auto name = std::to_string(block.first) + "x" + std::to_string(block.second) + "_" + profile.first;
+            add("astc", name, DXGI_FORMAT_UNKNOWN, 16, channels, [settings](const rgba_surface* src, uint8_t* dst) mutable {
+                CompressBlocksASTC(src, dst, &settings);
+            });
+            encoders.back().blockWidth = (uint32_t)block.first;
+            encoders.back().blockHeight = (uint32_t)block.second;
+        }
+    }
+    return encoders;
+}
+
+// ブロックの倍数に広げた入力。はみ出した部分は端のピクセルで埋める。
+// BC6HにLDRの画像を渡す場合はRGBA16Fに変換する。
+struct Surface {
+    std::vector<uint8_t> pixels;
+    rgba_surface surface;
+};
+
+void prepareSurface(const Source& source, const Encoder& encoder, Surface& result) {
+    size_t bpp = encoder.hdr ? 8 : 4;
+    uint32_t width = ROUNDUP(source.width, encoder.blockWidth);
+    uint32_t height = ROUNDUP(source.height, encoder.blockHeight);
+    size_t stride = width * bpp;
+    result.pixels.resize(stride * height);
+
+    std::vector<uint8_t> halfRow;
+    for (uint32_t y = 0; y < height; ++y) {
+        const uint8_t* src = source.pixels.data() + (size_t)std::min(y, source.height - 1) * source.width * (source.hdr ? 8 : 4);
+        uint8_t* dst = result.pixels.data() + y * stride;
+        if (encoder.hdr && !source.hdr) {
+            halfRow.resize(source.width * 8);
+            util::convertRowToRGBA16F(src, reinterpret_cast<uint16_t*>(halfRow.data()), source.width, util::PixelLayout::RGBA, false);
+            src = halfRow.data();
+        }
+        memcpy(dst, src, source.width * bpp);
+        for (uint32_t x = source.width; x < width; ++x)
+            memcpy(dst + x * bpp, dst + (source.width - 1) * bpp, bpp);
+    }
+    result.surface.ptr = result.pixels.data();
+    result.surface.width = (int32_t)width;
+    result.surface.height = (int32_t)height;
+    result.surface.stride = (int32_t)stride;
+}
+
+// ドライバと同じく、ブロック行を帯に分けてスレッドプールで圧縮する。
+void compressParallel(util::ThreadPool& pool, const Encoder& encoder, const rgba_surface& surface, uint8_t* dst) {
+    size_t blockRows = surface.height / encoder.blockHeight;
+    size_t dstRowPitch = surface.width / encoder.blockWidth * encoder.blockBytes;
+    size_t rowsPerBand = std::max(blockRows / (pool.getThreadCount() * 4), (size_t)1);
+    pool.parallelFor((blockRows + rowsPerBand - 1) / rowsPerBand, [&](size_t i) {
+        size_t first = i * rowsPerBand;
+        size_t rows = std::min(rowsPerBand, blockRows - first);
+        rgba_surface band = surface;
+        band.ptr += first * encoder.blockHeight * surface.stride;
+        band.height = (int32_t)(rows * encoder.blockHeight);
+        encoder.compress(&band, dst + first * dstRowPitch);
+    });
+}
+
+// ETC1のブロックを展開する。DirectXTexはETC1に対応していないので自前で行う。
+void decodeEtc1Block(const uint8_t* block, float* rgba, size_t pitch) {
+    static const int kModifiers[8][2] = {
+        { 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 }, { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 },
+    };
+    int base[2][3];
+    bool diff = (block[3] & 2) != 0;
+    bool flip = (block[3] & 1) != 0;
+    for (int c = 0; c < 3; ++c) {
+        if (diff) {
+            int c1 = block[c] >> 3;
+            int delta = (block[c] & 7) - ((block[c] & 4) << 1);
+            int c2 = c1 + delta;
+            base[0][c] = (c1 << 3) | (c1 >> 2);
+            base[1][c] = (c2 << 3) | (c2 >> 2);
+        }
+        else {
+            base[0][c] = (block[c] >> 4) * 17;
+            base[1][c] = (block[c] & 15) * 17;
+        }
+    }
+    int table[2] = { (block[3] >> 5) & 7, (block[3] >> 2) & 7 };
+    uint32_t indices = ((uint32_t)block[4] << 24) | ((uint32_t)block[5] << 16) | ((uint32_t)block[6] << 8) | block[7];
+    for (int y = 0; y < 4; ++y) {
+        for (int x = 0; x < 4; ++x) {
+            int i = x * 4 + y;
+            int index = (((indices >> (16 + i)) & 1) << 1) | ((indices >> i) & 1);
+            int sub = flip ? (y >= 2) : (x >= 2);
+            int modifier = kModifiers[table[sub]][index & 1];
+            if (index & 2) modifier = -modifier;
+            float* pixel = rgba + y * pitch + x * 4;
+            for (int c = 0; c < 3; ++c)
+                pixel[c] = (float)std::min(std::max(base[sub][c] + modifier, 0), 255);
+            pixel[3] = 255.0f;
+        }
+    }
+}
+
+// 圧縮結果を展開してPSNRを求める。LDRは255、HDRは入力の最大値をピークとする。
+// 展開できないフォーマットの場合は負の値を返す。
+double computePsnr(const Encoder& encoder, const Surface& input, const Source& source, const std::vector<uint8_t>& blocks) {
+    size_t width = (size_t)input.surface.width;
+    size_t height = (size_t)input.surface.height;
+    std::vector<float> decoded(width * height * 4);
+
+    if (encoder.dxgiFormat != DXGI_FORMAT_UNKNOWN) {
+        DirectX::Image image = {};
+        image.width = width;
+        image.height = height;
+        image.format = encoder.dxgiFormat;
+        image.rowPitch = width / 4 * encoder.blockBytes;
+        image.slicePitch = image.rowPitch * (height / 4);
+        image.pixels = const_cast<uint8_t*>(blocks.data());
+        DirectX::ScratchImage result;
+        if (FAILED(DirectX::Decompress(image, DXGI_FORMAT_R32G32B32A32_FLOAT, result)))
+            return -1.0;
+        auto out = result.GetImage(0, 0, 0);
+        float scale = encoder.hdr ? 1.0f : 255.0f;
+        for (size_t y = 0; y < height; ++y) {
+            auto row = reinterpret_cast<const float*>(out->pixels + y * out->rowPitch);
+            for (size_t i = 0; i < width * 4; ++i)
+                decoded[y * width * 4 + i] = row[i] * scale;
+        }
+    }
+    else if (encoder.format == "etc1") {
+        size_t blocksPerRow = width / 4;
+        for (size_t by = 0; by < height / 4; ++by)
+            for (size_t bx = 0; bx < blocksPerRow; ++bx)
+                decodeEtc1Block(blocks.data() + (by * blocksPerRow + bx) * 8, decoded.data() + (by * 4 * width + bx * 4) * 4, width * 4);
+    }
+    else {
+        return -1.0;
+    }
+
+    // 比較は元の画像の範囲だけで行う。
+    double sum = 0.0;
+    double peak = encoder.hdr ? 0.0 : 255.0;
+    for (uint32_t y = 0; y < source.height; ++y) {
+        for (uint32_t x = 0; x < source.width; ++x) {
+            const uint8_t* pixel = input.pixels.data() + y * (size_t)input.surface.stride + x * (encoder.hdr ? 8 : 4);
+            const float* result = decoded.data() + (y * width + x) * 4;
+            for (int c = 0; c < encoder.channels; ++c) {
+                double expected = encoder.hdr ? util::halfToFloat(reinterpret_cast<const uint16_t*>(pixel)[c]) : pixel[c];
+                if (encoder.hdr) peak = std::max(peak, expected);
+                double error = expected - result[c];
+                sum += error * error;
+            }
+        }
+    }
+    double mse = sum / ((double)source.width * source.height * encoder.channels);
+    if (mse <= 0.0) return 999.0;
+    return 10.0 * std::log10(peak * peak / mse);
+}
+
+void runKernels(util::ThreadPool& pool, const Options& options, const std::vector<Source>& sources, std::vector<KernelResult>& results) {
+    auto encoders = makeEncoders();
+    Surface input;
+    std::vector<uint8_t> blocks;
+    for (auto& source : sources) {
+        for (auto& encoder : encoders) {
+            if (!isFormatSelected(options, encoder.format) || !isProfileSelected(options, encoder.profile))
+                continue;
+            // HDRの画像はBC6Hでのみ計測する。
+            if (source.hdr && !encoder.hdr)
+                continue;
+
+            KernelResult result;
+            result.source = source.name;
+            result.format = encoder.format;
+            result.profile = encoder.profile;
+            result.width = source.width;
+            result.height = source.height;
+            auto start = Clock::now();
+            prepareSurface(source, encoder, input);
+            result.prepareSeconds = secondsSince(start);
+
+            blocks.resize(input.surface.width / encoder.blockWidth * (input.surface.height / encoder.blockHeight) * encoder.blockBytes);
+            result.compressSeconds = 1e30;
+            for (uint32_t i = 0; i < options.iterations; ++i) {
+                start = Clock::now();
+                compressParallel(pool, encoder, input.surface, blocks.data());
+                result.compressSeconds = std::min(result.compressSeconds, secondsSince(start));
+            }
+
+            start = Clock::now();
+            result.psnr = computePsnr(encoder, input, source, blocks);
+            result.decodeSeconds = secondsSince(start);
+
+            double mpix = (double)source.width * source.height / result.compressSeconds / 1e6;
+            if (result.psnr >= 0.0)
+                printf("%-20s %-5s %-18s %10.2f MPix/s %8.2f dB\n", source.name.c_str(), encoder.format.c_str(), encoder.profile.c_str(), mpix, result.psnr);
+            else
+                printf("%-20s %-5s %-18s %10.2f MPix/s        -\n", source.name.c_str(), encoder.format.c_str(), encoder.profile.c_str(), mpix);
+            results.push_back(result);
+        }
+    }
+}
+
+void* allocateOutput(void* userData, size_t size) {
+    auto buffer = static_cast<std::vector<uint8_t>*>(userData);
+    buffer->resize(size);
+    return buffer->data();
+}
+
+// libddsconvを通して、読み込みから書き出しまでを計測する。
+void runPipeline(const Options& options, const std::vector<Source>& sources, std::vector<PipelineResult>& results) {
+    auto context = ddsconv_create_context(options.threads);
+    if (!context) return;
+
+    const std::pair<const char*, int> formats[] = {
+        { "bc1", DDSCONV_FORMAT_BC1 }, { "bc3", DDSCONV_FORMAT_BC3 }, { "bc4", DDSCONV_FORMAT_BC4 },
+        { "bc5", DDSCONV_FORMAT_BC5 }, { "bc6h", DDSCONV_FORMAT_BC6H }, { "bc7", DDSCONV_FORMAT_BC7 },
+    };
+    const char* const qualities[] = { "ultrafast", "veryfast", "fast", "basic", "slow", "veryslow" };
+
+    std::vector<uint8_t> buffer;
+    for (auto& source : sources) {
+        // 生成したHDR画像はRGBA8で渡せないので、コーパスの画像だけを使う。
+        if (source.hdr && source.file.empty())
+            continue;
+        ddsconv_input input = {};
+        if (!source.file.empty()) {
+            input.data = source.file.data();
+            input.size = source.file.size();
+        }
+        else {
+            input.data = source.pixels.data();
+            input.size = source.pixels.size();
+            input.width = source.width;
+            input.height = source.height;
+        }
+
+        for (auto& format : formats) {
+            if (!isFormatSelected(options, format.first))
+                continue;
+            // 品質の設定が効くのはBC6HとBC7だけ。
+            bool hasQuality = format.second == DDSCONV_FORMAT_BC6H || format.second == DDSCONV_FORMAT_BC7;
+            for (int quality = 0; quality < (hasQuality ? 6 : 1); ++quality) {
+                if (hasQuality && !isProfileSelected(options, qualities[quality]))
+                    continue;
+                ddsconv_options settings;
+                ddsconv_get_default_options(&settings);
+                settings.format = format.second;
+                settings.quality = quality;
+                ddsconv_output output = {};
+                output.allocate = allocateOutput;
+                output.user_data = &buffer;
+
+                double best = 1e30;
+                bool failed = false;
+                for (uint32_t i = 0; i < options.iterations && !failed; ++i) {
+                    auto start = Clock::now();
+                    output.buffer = buffer.data();
+                    output.capacity = buffer.size();
+                    failed = ddsconv_convert(context, &input, &settings, &output) != DDSCONV_OK;
+                    best = std::min(best, secondsSince(start));
+                }
+                if (failed) {
+                    printf("%-20s %-5s %-18s %s\n", source.name.c_str(), format.first, "pipeline", output.error);
+                    continue;
+                }
+
+                const char* name = hasQuality ? qualities[quality] : "default";
+                PipelineResult result = { source.name, format.first, name, source.width, source.height, best, output.size };
+                printf("%-20s %-5s %-18s %10.2f MPix/s (pipeline)\n", source.name.c_str(), format.first, name,
+                       (double)source.width * source.height / best / 1e6);
+                results.push_back(result);
+            }
+        }
+    }
+    ddsconv_destroy_context(context);
+}
+
+std::string escapeJson(const std::string& text) {
+    std::string result;
+    for (char c : text) {
+        if (c == '"' || c == '\\') result.push_back('\\');
+        if ((unsigned char)c < 0x20) continue;
+        result.push_back(c);
+    }
+    return result;
+}
+
+bool writeJson(const std::filesystem::path& path, const Options& options, const std::vector<Source>& sources,
+               const std::vector<KernelResult>& kernels, const std::vector<PipelineResult>& pipelines, size_t threads) {
+    FILE* file = nullptr;
+#ifdef _WIN32
+    _wfopen_s(&file, path.c_str(), L"wb");
+#else
+    file = fopen(path.c_str(), "wb");
+#endif
+    if (!file) return false;
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"version\": \"%s\",\n", VERSION);
+    fprintf(file, "  \"ispcTexcompVersion\": %d,\n", ISPC_TEXCOMP_VERSION);
+    fprintf(file, "  \"ispcTargets\": \"%s\",\n", DDSCONV_ISPC_TARGETS);
+    fprintf(file, "  \"isa\": \"%s\",\n", GetTargetISA());
+    fprintf(file, "  \"threads\": %zu,\n", threads);
+    fprintf(file, "  \"iterations\": %u,\n", options.iterations);
+
+    fprintf(file, "  \"sources\": [\n");
+    for (size_t i = 0; i < sources.size(); ++i) {
+        auto& s = sources[i];
+        fprintf(file, "    { \"name\": \"%s\", \"width\": %u, \"height\": %u, \"hdr\": %s, \"loadSeconds\": %.6f }%s\n",
+                escapeJson(s.name).c_str(), s.width, s.height, s.hdr ? "true" : "false", s.loadSeconds, i + 1 < sources.size() ? "," : "");
+    }
+    fprintf(file, "  ],\n");
+
+    fprintf(file, "  \"kernels\": [\n");
+    for (size_t i = 0; i < kernels.size(); ++i) {
+        auto& r = kernels[i];
+        double mpix = (double)r.width * r.height / r.compressSeconds / 1e6;
+        fprintf(file, "    { \"source\": \"%s\", \"format\": \"%s\", \"profile\": \"%s\", \"mpixPerSecond\": %.3f, "
+                      "\"stages\": { \"prepare\": %.6f, \"compress\": %.6f, \"decode\": %.6f }, \"psnr\": ",
+                escapeJson(r.source).c_str(), r.format.c_str(), r.profile.c_str(), mpix, r.prepareSeconds, r.compressSeconds, r.decodeSeconds);
+        if (r.psnr >= 0.0) fprintf(file, "%.3f", r.psnr);
+        else fprintf(file, "null");
+        fprintf(file, " }%s\n", i + 1 < kernels.size() ? "," : "");
+    }
+    fprintf(file, "  ],\n");
+
+    fprintf(file, "  \"pipeline\": [\n");
+    for (size_t i = 0; i < pipelines.size(); ++i) {
+        auto& r = pipelines[i];
+        fprintf(file, "    { \"source\": \"%s\", \"format\": \"%s\", \"quality\": \"%s\", \"mpixPerSecond\": %.3f, \"seconds\": %.6f, \"outputSize\": %zu }%s\n",
+                escapeJson(r.source).c_str(), r.format.c_str(), r.quality.c_str(), (double)r.width * r.height / r.seconds / 1e6,
+                r.seconds, r.outputSize, i + 1 < pipelines.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+    fclose(file);
+    return true;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (parseArguments(options, argc, argv) != 0)
+        return 1;
+    if (!options.isa.empty() && !SetTargetISA(options.isa.c_str())) {
+        printf("ISA \"%s\" is not available. Compiled targets: %s\n", options.isa.c_str(), GetCompiledISAs());
+        return 1;
+    }
+
+#ifdef _WIN32
+    // コーパスの読み込みにWICを使う。
+    if (FAILED(CoInitializeEx(NULL, COINIT_MULTITHREADED)))
+        return 1;
+#endif
+
+    std::vector<Source> sources;
+    if (options.generated)
+        sources = generateSources(options.size);
+    if (!options.corpus.empty()) {
+        std::error_code ec;
+        for (auto& entry : std::filesystem::directory_iterator(options.corpus, ec)) {
+            if (!entry.is_regular_file()) continue;
+            Source source;
+            if (loadSource(entry.path(), source))
+                sources.push_back(std::move(source));
+            else
+                printf("Skipped %s\n", entry.path().u8string().c_str());
+        }
+    }
+    if (sources.empty())
+        ABORT("No input images.");
+
+    util::ThreadPool pool(options.threads);
+    printf("ISPC targets: %s, ISA: %s, threads: %zu\n", DDSCONV_ISPC_TARGETS, GetTargetISA(), pool.getThreadCount());
+
+    std::vector<KernelResult> kernels;
+    runKernels(pool, options, sources, kernels);
+
+    std::vector<PipelineResult> pipelines;
+    if (options.pipeline)
+        runPipeline(options, sources, pipelines);
+
+    if (!options.json.empty() && !writeJson(options.json, options, sources, kernels, pipelines, pool.getThreadCount()))
+        ABORT("Failed to write the JSON file.");
+    return 0;
+}
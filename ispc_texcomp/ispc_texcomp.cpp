@@ -1,472 +1,669 @@
-////////////////////////////////////////////////////////////////////////////////
-// Copyright (c) 2016-2019, Intel Corporation
-//
-// Permission is hereby granted, free of charge, to any person obtaining a copy
-// of this software and associated documentation files (the "Software"), to
-// deal in the Software without restriction, including without limitation the
-// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
-// sell copies of the Software, and to permit persons to whom the Software is
-// furnished to do so, subject to the following conditions:
-//
-// The above copyright notice and this permission notice shall be included in
-// all copies or substantial portions of the Software.
-//
-// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
-// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
-// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
-// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
-// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
-// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
-// IN THE SOFTWARE.
-////////////////////////////////////////////////////////////////////////////////
-
-#include "ispc_texcomp.h"
-#include "kernel_ispc.h"
-#include <memory.h> // memcpy
-
-void GetProfile_ultrafast(bc7_enc_settings* settings)
-{
-    settings->channels = 3;
-
-	// mode02
-	settings->mode_selection[0] = false;
-	settings->skip_mode2 = true;
-
-	settings->refineIterations[0] = 2;
-	settings->refineIterations[2] = 2;
-
-	// mode13
-	settings->mode_selection[1] = false;
-	settings->fastSkipTreshold_mode1 = 3;
-	settings->fastSkipTreshold_mode3 = 1;
-    settings->fastSkipTreshold_mode7 = 0;
-
-	settings->refineIterations[1] = 2;
-	settings->refineIterations[3] = 1;
-
-	// mode45
-	settings->mode_selection[2] = false;
-
-    settings->mode45_channel0 = 0;
-	settings->refineIterations_channel = 0;
-	settings->refineIterations[4] = 2;
-	settings->refineIterations[5] = 2;
-
-	// mode6
-	settings->mode_selection[3] = true;
-
-	settings->refineIterations[6] = 1;
-}
-
-void GetProfile_veryfast(bc7_enc_settings* settings)
-{
-    settings->channels = 3;
-
-	// mode02
-	settings->mode_selection[0] = false;
-	settings->skip_mode2 = true;
-
-	settings->refineIterations[0] = 2;
-	settings->refineIterations[2] = 2;
-
-	// mode13
-	settings->mode_selection[1] = true;
-	settings->fastSkipTreshold_mode1 = 3;
-	settings->fastSkipTreshold_mode3 = 1;
-    settings->fastSkipTreshold_mode7 = 0;
-
-	settings->refineIterations[1] = 2;
-	settings->refineIterations[3] = 1;
-
-	// mode45
-	settings->mode_selection[2] = false;
-
-    settings->mode45_channel0 = 0;
-	settings->refineIterations_channel = 0;
-	settings->refineIterations[4] = 2;
-	settings->refineIterations[5] = 2;
-
-	// mode6
-	settings->mode_selection[3] = true;
-
-	settings->refineIterations[6] = 1;
-}
-
-void GetProfile_fast(bc7_enc_settings* settings)
-{	
-    settings->channels = 3;
-
-	// mode02
-	settings->mode_selection[0] = false;
-	settings->skip_mode2 = true;
-
-	settings->refineIterations[0] = 2;
-	settings->refineIterations[2] = 2;
-
-	// mode13
-	settings->mode_selection[1] = true;
-	settings->fastSkipTreshold_mode1 = 12;
-	settings->fastSkipTreshold_mode3 = 4;
-    settings->fastSkipTreshold_mode7 = 0;
-
-	settings->refineIterations[1] = 2;
-	settings->refineIterations[3] = 1;
-
-	// mode45
-	settings->mode_selection[2] = false;
-
-    settings->mode45_channel0 = 0;
-	settings->refineIterations_channel = 0;
-	settings->refineIterations[4] = 2;
-	settings->refineIterations[5] = 2;
-
-	// mode6
-	settings->mode_selection[3] = true;
-
-	settings->refineIterations[6] = 2;
-}
-
-void GetProfile_basic(bc7_enc_settings* settings)
-{	
-    settings->channels = 3;
-
-	// mode02
-	settings->mode_selection[0] = true;
-	settings->skip_mode2 = true;
-
-	settings->refineIterations[0] = 2;
-	settings->refineIterations[2] = 2;
-
-	// mode13
-	settings->mode_selection[1] = true;
-	settings->fastSkipTreshold_mode1 = 8+4;
-	settings->fastSkipTreshold_mode3 = 8;
-    settings->fastSkipTreshold_mode7 = 0;
-
-	settings->refineIterations[1] = 2;
-	settings->refineIterations[3] = 2;
-
-	// mode45
-	settings->mode_selection[2] = true;
-
-    settings->mode45_channel0 = 0;
-	settings->refineIterations_channel = 2;
-	settings->refineIterations[4] = 2;
-	settings->refineIterations[5] = 2;
-
-	// mode6
-	settings->mode_selection[3] = true;
-
-	settings->refineIterations[6] = 2;
-}
-
-void GetProfile_slow(bc7_enc_settings* settings)
-{	
-    settings->channels = 3;
-
-	int moreRefine = 2;
-	// mode02
-	settings->mode_selection[0] = true;
-	settings->skip_mode2 = false;
-
-	settings->refineIterations[0] = 2+moreRefine;
-	settings->refineIterations[2] = 2+moreRefine;
-
-	// mode13
-	settings->mode_selection[1] = true;
-	settings->fastSkipTreshold_mode1 = 64;
-	settings->fastSkipTreshold_mode3 = 64;
-	settings->fastSkipTreshold_mode7 = 0;
-
-	settings->refineIterations[1] = 2+moreRefine;
-	settings->refineIterations[3] = 2+moreRefine;
-
-	// mode45
-	settings->mode_selection[2] = true;
-
-    settings->mode45_channel0 = 0;
-	settings->refineIterations_channel = 2+moreRefine;
-	settings->refineIterations[4] = 2+moreRefine;
-	settings->refineIterations[5] = 2+moreRefine;
-
-	// mode6
-	settings->mode_selection[3] = true;
-
-	settings->refineIterations[6] = 2+moreRefine;
-}
-
-void GetProfile_alpha_ultrafast(bc7_enc_settings* settings)
-{	
-    settings->channels = 4;
-
-    // mode02
-	settings->mode_selection[0] = false;
-	settings->skip_mode2 = true;
-
-	settings->refineIterations[0] = 2;
-	settings->refineIterations[2] = 2;
-
-	// mode137
-	settings->mode_selection[1] = false;
-	settings->fastSkipTreshold_mode1 = 0;
-	settings->fastSkipTreshold_mode3 = 0;
-    settings->fastSkipTreshold_mode7 = 4;
-
-	settings->refineIterations[1] = 1;
-	settings->refineIterations[3] = 1;
-    settings->refineIterations[7] = 2;
-
-	// mode45
-	settings->mode_selection[2] = true;
-    
-    settings->mode45_channel0 = 3;
-    settings->refineIterations_channel = 1;
-	settings->refineIterations[4] = 1;
-	settings->refineIterations[5] = 1;
-
-	// mode6
-	settings->mode_selection[3] = true;
-
-	settings->refineIterations[6] = 2;
-}
-
-void GetProfile_alpha_veryfast(bc7_enc_settings* settings)
-{	
-    settings->channels = 4;
-
-    // mode02
-	settings->mode_selection[0] = false;
-	settings->skip_mode2 = true;
-
-	settings->refineIterations[0] = 2;
-	settings->refineIterations[2] = 2;
-
-	// mode137
-	settings->mode_selection[1] = true;
-	settings->fastSkipTreshold_mode1 = 0;
-	settings->fastSkipTreshold_mode3 = 0;
-    settings->fastSkipTreshold_mode7 = 4;
-
-	settings->refineIterations[1] = 1;
-	settings->refineIterations[3] = 1;
-    settings->refineIterations[7] = 2;
-
-	// mode45
-	settings->mode_selection[2] = true;
-    
-    settings->mode45_channel0 = 3;
-    settings->refineIterations_channel = 2;
-	settings->refineIterations[4] = 2;
-	settings->refineIterations[5] = 2;
-
-	// mode6
-	settings->mode_selection[3] = true;
-
-	settings->refineIterations[6] = 2;
-}
-
-void GetProfile_alpha_fast(bc7_enc_settings* settings)
-{	
-    settings->channels = 4;
-
-    // mode02
-	settings->mode_selection[0] = false;
-	settings->skip_mode2 = true;
-
-	settings->refineIterations[0] = 2;
-	settings->refineIterations[2] = 2;
-
-	// mode137
-	settings->mode_selection[1] = true;
-	settings->fastSkipTreshold_mode1 = 4;
-	settings->fastSkipTreshold_mode3 = 4;
-    settings->fastSkipTreshold_mode7 = 8;
-
-	settings->refineIterations[1] = 1;
-	settings->refineIterations[3] = 1;
-    settings->refineIterations[7] = 2;
-
-	// mode45
-	settings->mode_selection[2] = true;
-    
-    settings->mode45_channel0 = 3;
-    settings->refineIterations_channel = 2;
-	settings->refineIterations[4] = 2;
-	settings->refineIterations[5] = 2;
-
-	// mode6
-	settings->mode_selection[3] = true;
-
-	settings->refineIterations[6] = 2;
-}
-
-void GetProfile_alpha_basic(bc7_enc_settings* settings)
-{	
-    settings->channels = 4;
-
-    // mode02
-	settings->mode_selection[0] = true;
-	settings->skip_mode2 = true;
-
-	settings->refineIterations[0] = 2;
-	settings->refineIterations[2] = 2;
-
-	// mode137
-	settings->mode_selection[1] = true;
-	settings->fastSkipTreshold_mode1 = 8+4;
-	settings->fastSkipTreshold_mode3 = 8;
-    settings->fastSkipTreshold_mode7 = 8;
-
-	settings->refineIterations[1] = 2;
-	settings->refineIterations[3] = 2;
-    settings->refineIterations[7] = 2;
-
-	// mode45
-	settings->mode_selection[2] = true;
-    
-    settings->mode45_channel0 = 0;
-    settings->refineIterations_channel = 2;
-	settings->refineIterations[4] = 2;
-	settings->refineIterations[5] = 2;
-
-	// mode6
-	settings->mode_selection[3] = true;
-
-	settings->refineIterations[6] = 2;
-}
-
-void GetProfile_alpha_slow(bc7_enc_settings* settings)
-{	
-    settings->channels = 4;
-
-	int moreRefine = 2;
-	// mode02
-	settings->mode_selection[0] = true;
-	settings->skip_mode2 = false;
-
-	settings->refineIterations[0] = 2+moreRefine;
-	settings->refineIterations[2] = 2+moreRefine;
-
-	// mode137
-	settings->mode_selection[1] = true;
-	settings->fastSkipTreshold_mode1 = 64;
-	settings->fastSkipTreshold_mode3 = 64;
-    settings->fastSkipTreshold_mode7 = 64;
-
-	settings->refineIterations[1] = 2+moreRefine;
-	settings->refineIterations[3] = 2+moreRefine;
-	settings->refineIterations[7] = 2+moreRefine;
-
-	// mode45
-	settings->mode_selection[2] = true;
-
-    settings->mode45_channel0 = 0;
-	settings->refineIterations_channel = 2+moreRefine;
-	settings->refineIterations[4] = 2+moreRefine;
-	settings->refineIterations[5] = 2+moreRefine;
-
-	// mode6
-	settings->mode_selection[3] = true;
-
-	settings->refineIterations[6] = 2+moreRefine;
-}
-
-void GetProfile_bc6h_veryfast(bc6h_enc_settings* settings)
-{
-    settings->slow_mode = false;
-    settings->fast_mode = true;
-    settings->fastSkipTreshold = 0;
-    settings->refineIterations_1p = 0;
-    settings->refineIterations_2p = 0;
-}
-
-void GetProfile_bc6h_fast(bc6h_enc_settings* settings)
-{
-    settings->slow_mode = false;
-    settings->fast_mode = true;
-    settings->fastSkipTreshold = 2;
-    settings->refineIterations_1p = 0;
-    settings->refineIterations_2p = 1;
-}
-
-void GetProfile_bc6h_basic(bc6h_enc_settings* settings)
-{
-    settings->slow_mode = false;
-    settings->fast_mode = false;
-    settings->fastSkipTreshold = 4;
-    settings->refineIterations_1p = 2;
-    settings->refineIterations_2p = 2;
-}
-
-void GetProfile_bc6h_slow(bc6h_enc_settings* settings)
-{
-    settings->slow_mode = true;
-    settings->fast_mode = false;
-    settings->fastSkipTreshold = 10;
-    settings->refineIterations_1p = 2;
-    settings->refineIterations_2p = 2;
-}
-
-void GetProfile_bc6h_veryslow(bc6h_enc_settings* settings)
-{
-    settings->slow_mode = true;
-    settings->fast_mode = false;
-    settings->fastSkipTreshold = 32;
-    settings->refineIterations_1p = 2;
-    settings->refineIterations_2p = 2;
-}
-
-void GetProfile_etc_slow(etc_enc_settings* settings)
-{
-    settings->fastSkipTreshold = 6;
-}
-
-void ReplicateBorders(rgba_surface* dst_slice, const rgba_surface* src_tex, int start_x, int start_y, int bpp)
-{
-    int bytes_per_pixel = bpp >> 3;
-    
-    bool aliasing = false;
-    if (&src_tex->ptr[src_tex->stride * start_y + bytes_per_pixel * start_x] == dst_slice->ptr) aliasing = true;
-
-    for (int y = 0; y < dst_slice->height; y++)
-    for (int x = 0; x < dst_slice->width; x++)
-    {
-        int xx = start_x + x;
-        int yy = start_y + y;
-
-        if (aliasing && xx < src_tex->width && yy < src_tex->height) continue;
-
-        if (xx >= src_tex->width) xx = src_tex->width - 1;
-        if (yy >= src_tex->height) yy = src_tex->height - 1;
-
-        void* dst = &dst_slice->ptr[dst_slice->stride * y + bytes_per_pixel * x];
-        void* src = &src_tex->ptr[src_tex->stride * yy + bytes_per_pixel * xx];
-
-        memcpy(dst, src, bytes_per_pixel);
-    }
-}
-
-void CompressBlocksBC1(const rgba_surface* src, uint8_t* dst)
-{
-	ispc::CompressBlocksBC1_ispc((ispc::rgba_surface*)src, dst);
-}
-
-void CompressBlocksBC3(const rgba_surface* src, uint8_t* dst)
-{
-	ispc::CompressBlocksBC3_ispc((ispc::rgba_surface*)src, dst);
-}
-
-void CompressBlocksBC7(const rgba_surface* src, uint8_t* dst, bc7_enc_settings* settings)
-{
-	ispc::CompressBlocksBC7_ispc((ispc::rgba_surface*)src, dst, (ispc::bc7_enc_settings*)settings);
-}
-
-void CompressBlocksBC6H(const rgba_surface* src, uint8_t* dst, bc6h_enc_settings* settings)
-{
-    ispc::CompressBlocksBC6H_ispc((ispc::rgba_surface*)src, dst, (ispc::bc6h_enc_settings*)settings);
-}
-
-void CompressBlocksETC1(const rgba_surface* src, uint8_t* dst, etc_enc_settings* settings)
-{
-    ispc::CompressBlocksETC1_ispc((ispc::rgba_surface*)src, dst, (ispc::etc_enc_settings*)settings);
-}
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016-2019, Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "ispc_texcomp.h"
+#include "kernel_ispc.h"
+#include <memory.h> // memcpy
+#include <string.h> // strcmp
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+// Per-target entry points. When the kernels are built for several ISPC targets every
+// export is also emitted with the target name appended, next to the plain name that
+// dispatches to the best target the CPU supports. The CMake build generates the list
+// from DDSCONV_ISPC_TARGETS, the Visual Studio project uses the targets on its ispc
+// command line. With a single target there are no suffixed names and the list is empty.
+#if defined(ISPC_TEXCOMP_ISAS_HEADER)
+#include "ispc_texcomp_isas.h"
+#elif defined(ISPC_TEXCOMP_X86_ISAS)
+#define ISPC_TEXCOMP_ISAS(X) X(sse2) X(sse4) X(avx) X(avx2) X(avx512skx)
+#else
+#define ISPC_TEXCOMP_ISAS(X)
+#endif
+
+struct kernel_set
+{
+    const char* isa;
+    int32_t (*GetTargetISA)();
+    void (*CompressBlocksBC1)(ispc::rgba_surface*, uint8_t*);
+    void (*CompressBlocksBC3)(ispc::rgba_surface*, uint8_t*);
+    void (*CompressBlocksBC4)(ispc::rgba_surface*, uint8_t*);
+    void (*CompressBlocksBC5)(ispc::rgba_surface*, uint8_t*);
+    void (*CompressBlocksBC7)(ispc::rgba_surface*, uint8_t*, ispc::bc7_enc_settings*);
+    void (*CompressBlocksBC6H)(ispc::rgba_surface*, uint8_t*, ispc::bc6h_enc_settings*);
+    void (*CompressBlocksBC7Stats)(ispc::rgba_surface*, uint8_t*, ispc::bc7_enc_settings*, ispc::bc7_enc_stats*);
+    void (*CompressBlocksBC6HStats)(ispc::rgba_surface*, uint8_t*, ispc::bc6h_enc_settings*, ispc::bc6h_enc_stats*);
+    void (*CompressBlocksBC7Errors)(ispc::rgba_surface*, uint8_t*, ispc::bc7_enc_settings*, ispc::bc7_enc_stats*, float*);
+    void (*CompressBlocksBC6HErrors)(ispc::rgba_surface*, uint8_t*, ispc::bc6h_enc_settings*, ispc::bc6h_enc_stats*, float*);
+    void (*CompressBlocksETC1)(ispc::rgba_surface*, uint8_t*, ispc::etc_enc_settings*);
+    void (*AnalyzeSurface)(ispc::rgba_surface*, ispc::surface_analysis*);
+    void (*ResampleRow)(const float*, float*, int32_t, const int32_t*, const float*, int32_t);
+    void (*ResampleColumns)(const float*, int32_t, float*, int32_t, const int32_t*, const float*, int32_t);
+};
+
+#define ISPC_TEXCOMP_DECLARE(isa) \
+    extern "C" { \
+    int32_t GetTargetISA_ispc_##isa(); \
+    void CompressBlocksBC1_ispc_##isa(ispc::rgba_surface*, uint8_t*); \
+    void CompressBlocksBC3_ispc_##isa(ispc::rgba_surface*, uint8_t*); \
+    void CompressBlocksBC4_ispc_##isa(ispc::rgba_surface*, uint8_t*); \
+    void CompressBlocksBC5_ispc_##isa(ispc::rgba_surface*, uint8_t*); \
+    void CompressBlocksBC7_ispc_##isa(ispc::rgba_surface*, uint8_t*, ispc::bc7_enc_settings*); \
+    void CompressBlocksBC6H_ispc_##isa(ispc::rgba_surface*, uint8_t*, ispc::bc6h_enc_settings*); \
+    void CompressBlocksBC7Stats_ispc_##isa(ispc::rgba_surface*, uint8_t*, ispc::bc7_enc_settings*, ispc::bc7_enc_stats*); \
+    void CompressBlocksBC6HStats_ispc_##isa(ispc::rgba_surface*, uint8_t*, ispc::bc6h_enc_settings*, ispc::bc6h_enc_stats*); \
+    void CompressBlocksBC7Errors_ispc_##isa(ispc::rgba_surface*, uint8_t*, ispc::bc7_enc_settings*, ispc::bc7_enc_stats*, float*); \
+    void CompressBlocksBC6HErrors_ispc_##isa(ispc::rgba_surface*, uint8_t*, ispc::bc6h_enc_settings*, ispc::bc6h_enc_stats*, float*); \
+    void CompressBlocksETC1_ispc_##isa(ispc::rgba_surface*, uint8_t*, ispc::etc_enc_settings*); \
+    void AnalyzeSurface_ispc_##isa(ispc::rgba_surface*, ispc::surface_analysis*); \
+    void ResampleRow_ispc_##isa(const float*, float*, int32_t, const int32_t*, const float*, int32_t); \
+    void ResampleColumns_ispc_##isa(const float*, int32_t, float*, int32_t, const int32_t*, const float*, int32_t); \
+    }
+ISPC_TEXCOMP_ISAS(ISPC_TEXCOMP_DECLARE)
+
+#define ISPC_TEXCOMP_SET(isa) { #isa, GetTargetISA_ispc_##isa, \
+    CompressBlocksBC1_ispc_##isa, CompressBlocksBC3_ispc_##isa, CompressBlocksBC4_ispc_##isa, \
+    CompressBlocksBC5_ispc_##isa, CompressBlocksBC7_ispc_##isa, CompressBlocksBC6H_ispc_##isa, \
+    CompressBlocksBC7Stats_ispc_##isa, CompressBlocksBC6HStats_ispc_##isa, \
+    CompressBlocksBC7Errors_ispc_##isa, CompressBlocksBC6HErrors_ispc_##isa, CompressBlocksETC1_ispc_##isa, \
+    AnalyzeSurface_ispc_##isa, ResampleRow_ispc_##isa, ResampleColumns_ispc_##isa },
+
+// the first entry goes through ISPC's own dispatch
+static const kernel_set kernel_sets[] =
+{
+    { "auto", ispc::GetTargetISA_ispc,
+      ispc::CompressBlocksBC1_ispc, ispc::CompressBlocksBC3_ispc, ispc::CompressBlocksBC4_ispc,
+      ispc::CompressBlocksBC5_ispc, ispc::CompressBlocksBC7_ispc, ispc::CompressBlocksBC6H_ispc,
+      ispc::CompressBlocksBC7Stats_ispc, ispc::CompressBlocksBC6HStats_ispc,
+      ispc::CompressBlocksBC7Errors_ispc, ispc::CompressBlocksBC6HErrors_ispc, ispc::CompressBlocksETC1_ispc,
+      ispc::AnalyzeSurface_ispc, ispc::ResampleRow_ispc, ispc::ResampleColumns_ispc },
+    ISPC_TEXCOMP_ISAS(ISPC_TEXCOMP_SET)
+};
+
+static const kernel_set* kernels = &kernel_sets[0];
+
+// indexed by GetTargetISA_ispc
+static const char* const isa_names[] = { "unknown", "sse2", "sse4", "avx", "avx2", "avx512skx", "neon" };
+
+bool IsTargetISASupported(const char* isa)
+{
+    if (strcmp(isa, "auto") == 0) return true;
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+    int info[4];
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool sse4 = (info[2] & (1 << 20)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    bool avx = (info[2] & (1 << 28)) != 0 && (xcr0 & 6) == 6;
+    __cpuidex(info, 7, 0);
+    bool avx2 = avx && (info[1] & (1 << 5)) != 0;
+    // F, DQ, CD, BW and VL, with the opmask and upper ZMM state enabled by the OS
+    const int skx = (1 << 16) | (1 << 17) | (1 << 28) | (1 << 30) | (1 << 31);
+    bool avx512skx = avx2 && (info[1] & skx) == skx && (xcr0 & 0xE0) == 0xE0;
+    if (strcmp(isa, "sse2") == 0) return sse2;
+    if (strcmp(isa, "sse4") == 0) return sse4;
+    if (strcmp(isa, "avx") == 0) return avx;
+    if (strcmp(isa, "avx2") == 0) return avx2;
+    if (strcmp(isa, "avx512skx") == 0) return avx512skx;
+    return false;
+#elif defined(__i386__) || defined(__x86_64__)
+    __builtin_cpu_init();
+    if (strcmp(isa, "sse2") == 0) return __builtin_cpu_supports("sse2");
+    if (strcmp(isa, "sse4") == 0) return __builtin_cpu_supports("sse4.2");
+    if (strcmp(isa, "avx") == 0) return __builtin_cpu_supports("avx");
+    if (strcmp(isa, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(isa, "avx512skx") == 0)
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512cd") &&
+               __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl");
+    return false;
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    return strcmp(isa, "neon") == 0;
+#else
+    return false;
+#endif
+}
+
+bool SetTargetISA(const char* isa)
+{
+    for (const kernel_set& set : kernel_sets)
+    {
+        if (strcmp(set.isa, isa) == 0 && IsTargetISASupported(isa))
+        {
+            kernels = &set;
+            return true;
+        }
+    }
+
+    // a single target build has no suffixed entry points, accept its own name
+    return sizeof(kernel_sets) / sizeof(kernel_sets[0]) == 1 && strcmp(isa, GetTargetISA()) == 0;
+}
+
+const char* GetTargetISA()
+{
+    int32_t index = kernels->GetTargetISA();
+    return index >= 0 && index < (int32_t)(sizeof(isa_names) / sizeof(isa_names[0])) ? isa_names[index] : isa_names[0];
+}
+
+const char* GetCompiledISAs()
+{
+#define ISPC_TEXCOMP_NAME(isa) "," #isa
+    static const char* const names = ISPC_TEXCOMP_ISAS(ISPC_TEXCOMP_NAME) "";
+#undef ISPC_TEXCOMP_NAME
+    // a single target build reports the target itself
+    return names[0] != '\0' ? names + 1 : GetTargetISA();
+}
+
+void GetProfile_ultrafast(bc7_enc_settings* settings)
+{
+    settings->channels = 3;
+
+	// mode02
+	settings->mode_selection[0] = false;
+	settings->skip_mode2 = true;
+
+	settings->refineIterations[0] = 2;
+	settings->refineIterations[2] = 2;
+
+	// mode13
+	settings->mode_selection[1] = false;
+	settings->fastSkipTreshold_mode1 = 3;
+	settings->fastSkipTreshold_mode3 = 1;
+    settings->fastSkipTreshold_mode7 = 0;
+
+	settings->refineIterations[1] = 2;
+	settings->refineIterations[3] = 1;
+
+	// mode45
+	settings->mode_selection[2] = false;
+
+    settings->mode45_channel0 = 0;
+	settings->refineIterations_channel = 0;
+	settings->refineIterations[4] = 2;
+	settings->refineIterations[5] = 2;
+
+	// mode6
+	settings->mode_selection[3] = true;
+
+	settings->refineIterations[6] = 1;
+}
+
+void GetProfile_veryfast(bc7_enc_settings* settings)
+{
+    settings->channels = 3;
+
+	// mode02
+	settings->mode_selection[0] = false;
+	settings->skip_mode2 = true;
+
+	settings->refineIterations[0] = 2;
+	settings->refineIterations[2] = 2;
+
+	// mode13
+	settings->mode_selection[1] = true;
+	settings->fastSkipTreshold_mode1 = 3;
+	settings->fastSkipTreshold_mode3 = 1;
+    settings->fastSkipTreshold_mode7 = 0;
+
+	settings->refineIterations[1] = 2;
+	settings->refineIterations[3] = 1;
+
+	// mode45
+	settings->mode_selection[2] = false;
+
+    settings->mode45_channel0 = 0;
+	settings->refineIterations_channel = 0;
+	settings->refineIterations[4] = 2;
+	settings->refineIterations[5] = 2;
+
+	// mode6
+	settings->mode_selection[3] = true;
+
+	settings->refineIterations[6] = 1;
+}
+
+void GetProfile_fast(bc7_enc_settings* settings)
+{	
+    settings->channels = 3;
+
+	// mode02
+	settings->mode_selection[0] = false;
+	settings->skip_mode2 = true;
+
+	settings->refineIterations[0] = 2;
+	settings->refineIterations[2] = 2;
+
+	// mode13
+	settings->mode_selection[1] = true;
+	settings->fastSkipTreshold_mode1 = 12;
+	settings->fastSkipTreshold_mode3 = 4;
+    settings->fastSkipTreshold_mode7 = 0;
+
+	settings->refineIterations[1] = 2;
+	settings->refineIterations[3] = 1;
+
+	// mode45
+	settings->mode_selection[2] = false;
+
+    settings->mode45_channel0 = 0;
+	settings->refineIterations_channel = 0;
+	settings->refineIterations[4] = 2;
+	settings->refineIterations[5] = 2;
+
+	// mode6
+	settings->mode_selection[3] = true;
+
+	settings->refineIterations[6] = 2;
+}
+
+void GetProfile_basic(bc7_enc_settings* settings)
+{	
+    settings->channels = 3;
+
+	// mode02
+	settings->mode_selection[0] = true;
+	settings->skip_mode2 = true;
+
+	settings->refineIterations[0] = 2;
+	settings->refineIterations[2] = 2;
+
+	// mode13
+	settings->mode_selection[1] = true;
+	settings->fastSkipTreshold_mode1 = 8+4;
+	settings->fastSkipTreshold_mode3 = 8;
+    settings->fastSkipTreshold_mode7 = 0;
+
+	settings->refineIterations[1] = 2;
+	settings->refineIterations[3] = 2;
+
+	// mode45
+	settings->mode_selection[2] = true;
+
+    settings->mode45_channel0 = 0;
+	settings->refineIterations_channel = 2;
+	settings->refineIterations[4] = 2;
+	settings->refineIterations[5] = 2;
+
+	// mode6
+	settings->mode_selection[3] = true;
+
+	settings->refineIterations[6] = 2;
+}
+
+void GetProfile_slow(bc7_enc_settings* settings)
+{	
+    settings->channels = 3;
+
+	int moreRefine = 2;
+	// mode02
+	settings->mode_selection[0] = true;
+	settings->skip_mode2 = false;
+
+	settings->refineIterations[0] = 2+moreRefine;
+	settings->refineIterations[2] = 2+moreRefine;
+
+	// mode13
+	settings->mode_selection[1] = true;
+	settings->fastSkipTreshold_mode1 = 64;
+	settings->fastSkipTreshold_mode3 = 64;
+	settings->fastSkipTreshold_mode7 = 0;
+
+	settings->refineIterations[1] = 2+moreRefine;
+	settings->refineIterations[3] = 2+moreRefine;
+
+	// mode45
+	settings->mode_selection[2] = true;
+
+    settings->mode45_channel0 = 0;
+	settings->refineIterations_channel = 2+moreRefine;
+	settings->refineIterations[4] = 2+moreRefine;
+	settings->refineIterations[5] = 2+moreRefine;
+
+	// mode6
+	settings->mode_selection[3] = true;
+
+	settings->refineIterations[6] = 2+moreRefine;
+}
+
+void GetProfile_alpha_ultrafast(bc7_enc_settings* settings)
+{	
+    settings->channels = 4;
+
+    // mode02
+	settings->mode_selection[0] = false;
+	settings->skip_mode2 = true;
+
+	settings->refineIterations[0] = 2;
+	settings->refineIterations[2] = 2;
+
+	// mode137
+	settings->mode_selection[1] = false;
+	settings->fastSkipTreshold_mode1 = 0;
+	settings->fastSkipTreshold_mode3 = 0;
+    settings->fastSkipTreshold_mode7 = 4;
+
+	settings->refineIterations[1] = 1;
+	settings->refineIterations[3] = 1;
+    settings->refineIterations[7] = 2;
+
+	// mode45
+	settings->mode_selection[2] = true;
+    
+    settings->mode45_channel0 = 3;
+    settings->refineIterations_channel = 1;
+	settings->refineIterations[4] = 1;
+	settings->refineIterations[5] = 1;
+
+	// mode6
+	settings->mode_selection[3] = true;
+
+	settings->refineIterations[6] = 2;
+}
+
+void GetProfile_alpha_veryfast(bc7_enc_settings* settings)
+{	
+    settings->channels = 4;
+
+    // mode02
+	settings->mode_selection[0] = false;
+	settings->skip_mode2 = true;
+
+	settings->refineIterations[0] = 2;
+	settings->refineIterations[2] = 2;
+
+	// mode137
+	settings->mode_selection[1] = true;
+	settings->fastSkipTreshold_mode1 = 0;
+	settings->fastSkipTreshold_mode3 = 0;
+    settings->fastSkipTreshold_mode7 = 4;
+
+	settings->refineIterations[1] = 1;
+	settings->refineIterations[3] = 1;
+    settings->refineIterations[7] = 2;
+
+	// mode45
+	settings->mode_selection[2] = true;
+    
+    settings->mode45_channel0 = 3;
+    settings->refineIterations_channel = 2;
+	settings->refineIterations[4] = 2;
+	settings->refineIterations[5] = 2;
+
+	// mode6
+	settings->mode_selection[3] = true;
+
+	settings->refineIterations[6] = 2;
+}
+
+void GetProfile_alpha_fast(bc7_enc_settings* settings)
+{	
+    settings->channels = 4;
+
+    // mode02
+	settings->mode_selection[0] = false;
+	settings->skip_mode2 = true;
+
+	settings->refineIterations[0] = 2;
+	settings->refineIterations[2] = 2;
+
+	// mode137
+	settings->mode_selection[1] = true;
+	settings->fastSkipTreshold_mode1 = 4;
+	settings->fastSkipTreshold_mode3 = 4;
+    settings->fastSkipTreshold_mode7 = 8;
+
+	settings->refineIterations[1] = 1;
+	settings->refineIterations[3] = 1;
+    settings->refineIterations[7] = 2;
+
+	// mode45
+	settings->mode_selection[2] = true;
+    
+    settings->mode45_channel0 = 3;
+    settings->refineIterations_channel = 2;
+	settings->refineIterations[4] = 2;
+	settings->refineIterations[5] = 2;
+
+	// mode6
+	settings->mode_selection[3] = true;
+
+	settings->refineIterations[6] = 2;
+}
+
+void GetProfile_alpha_basic(bc7_enc_settings* settings)
+{	
+    settings->channels = 4;
+
+    // mode02
+	settings->mode_selection[0] = true;
+	settings->skip_mode2 = true;
+
+	settings->refineIterations[0] = 2;
+	settings->refineIterations[2] = 2;
+
+	// mode137
+	settings->mode_selection[1] = true;
+	settings->fastSkipTreshold_mode1 = 8+4;
+	settings->fastSkipTreshold_mode3 = 8;
+    settings->fastSkipTreshold_mode7 = 8;
+
+	settings->refineIterations[1] = 2;
+	settings->refineIterations[3] = 2;
+    settings->refineIterations[7] = 2;
+
+	// mode45
+	settings->mode_selection[2] = true;
+    
+    settings->mode45_channel0 = 0;
+    settings->refineIterations_channel = 2;
+	settings->refineIterations[4] = 2;
+	settings->refineIterations[5] = 2;
+
+	// mode6
+	settings->mode_selection[3] = true;
+
+	settings->refineIterations[6] = 2;
+}
+
+void GetProfile_alpha_slow(bc7_enc_settings* settings)
+{	
+    settings->channels = 4;
+
+	int moreRefine = 2;
+	// mode02
+	settings->mode_selection[0] = true;
+	settings->skip_mode2 = false;
+
+	settings->refineIterations[0] = 2+moreRefine;
+	settings->refineIterations[2] = 2+moreRefine;
+
+	// mode137
+	settings->mode_selection[1] = true;
+	settings->fastSkipTreshold_mode1 = 64;
+	settings->fastSkipTreshold_mode3 = 64;
+    settings->fastSkipTreshold_mode7 = 64;
+
+	settings->refineIterations[1] = 2+moreRefine;
+	settings->refineIterations[3] = 2+moreRefine;
+	settings->refineIterations[7] = 2+moreRefine;
+
+	// mode45
+	settings->mode_selection[2] = true;
+
+    settings->mode45_channel0 = 0;
+	settings->refineIterations_channel = 2+moreRefine;
+	settings->refineIterations[4] = 2+moreRefine;
+	settings->refineIterations[5] = 2+moreRefine;
+
+	// mode6
+	settings->mode_selection[3] = true;
+
+	settings->refineIterations[6] = 2+moreRefine;
+}
+
+void GetProfile_bc6h_veryfast(bc6h_enc_settings* settings)
+{
+    settings->slow_mode = false;
+    settings->fast_mode = true;
+    settings->fastSkipTreshold = 0;
+    settings->refineIterations_1p = 0;
+    settings->refineIterations_2p = 0;
+}
+
+void GetProfile_bc6h_fast(bc6h_enc_settings* settings)
+{
+    settings->slow_mode = false;
+    settings->fast_mode = true;
+    settings->fastSkipTreshold = 2;
+    settings->refineIterations_1p = 0;
+    settings->refineIterations_2p = 1;
+}
+
+void GetProfile_bc6h_basic(bc6h_enc_settings* settings)
+{
+    settings->slow_mode = false;
+    settings->fast_mode = false;
+    settings->fastSkipTreshold = 4;
+    settings->refineIterations_1p = 2;
+    settings->refineIterations_2p = 2;
+}
+
+void GetProfile_bc6h_slow(bc6h_enc_settings* settings)
+{
+    settings->slow_mode = true;
+    settings->fast_mode = false;
+    settings->fastSkipTreshold = 10;
+    settings->refineIterations_1p = 2;
+    settings->refineIterations_2p = 2;
+}
+
+void GetProfile_bc6h_veryslow(bc6h_enc_settings* settings)
+{
+    settings->slow_mode = true;
+    settings->fast_mode = false;
+    settings->fastSkipTreshold = 32;
+    settings->refineIterations_1p = 2;
+    settings->refineIterations_2p = 2;
+}
+
+void GetProfile_etc_slow(etc_enc_settings* settings)
+{
+    settings->fastSkipTreshold = 6;
+}
+
+void ReplicateBorders(rgba_surface* dst_slice, const rgba_surface* src_tex, int start_x, int start_y, int bpp)
+{
+    int bytes_per_pixel = bpp >> 3;
+    
+    bool aliasing = false;
+    if (&src_tex->ptr[src_tex->stride * start_y + bytes_per_pixel * start_x] == dst_slice->ptr) aliasing = true;
+
+    for (int y = 0; y < dst_slice->height; y++)
+    for (int x = 0; x < dst_slice->width; x++)
+    {
+        int xx = start_x + x;
+        int yy = start_y + y;
+
+        if (aliasing && xx < src_tex->width && yy < src_tex->height) continue;
+
+        if (xx >= src_tex->width) xx = src_tex->width - 1;
+        if (yy >= src_tex->height) yy = src_tex->height - 1;
+
+        void* dst = &dst_slice->ptr[dst_slice->stride * y + bytes_per_pixel * x];
+        void* src = &src_tex->ptr[src_tex->stride * yy + bytes_per_pixel * xx];
+
+        memcpy(dst, src, bytes_per_pixel);
+    }
+}
+
+void AnalyzeSurface(const rgba_surface* src, surface_analysis* result)
+{
+    kernels->AnalyzeSurface((ispc::rgba_surface*)src, (ispc::surface_analysis*)result);
+}
+
+void ResampleRow(const float* src, float* dst, int width, const int* index, const float* weight, int taps)
+{
+    kernels->ResampleRow(src, dst, width, index, weight, taps);
+}
+
+void ResampleColumns(const float* src, int pitch, float* dst, int count, const int* index, const float* weight, int taps)
+{
+    kernels->ResampleColumns(src, pitch, dst, count, index, weight, taps);
+}
+
+void CompressBlocksBC1(const rgba_surface* src, uint8_t* dst)
+{
+	kernels->CompressBlocksBC1((ispc::rgba_surface*)src, dst);
+}
+
+void CompressBlocksBC3(const rgba_surface* src, uint8_t* dst)
+{
+	kernels->CompressBlocksBC3((ispc::rgba_surface*)src, dst);
+}
+
+void CompressBlocksBC4(const rgba_surface* src, uint8_t* dst)
+{
+	kernels->CompressBlocksBC4((ispc::rgba_surface*)src, dst);
+}
+
+void CompressBlocksBC5(const rgba_surface* src, uint8_t* dst)
+{
+	kernels->CompressBlocksBC5((ispc::rgba_surface*)src, dst);
+}
+
+void CompressBlocksBC7(const rgba_surface* src, uint8_t* dst, bc7_enc_settings* settings)
+{
+	kernels->CompressBlocksBC7((ispc::rgba_surface*)src, dst, (ispc::bc7_enc_settings*)settings);
+}
+
+void CompressBlocksBC6H(const rgba_surface* src, uint8_t* dst, bc6h_enc_settings* settings)
+{
+    kernels->CompressBlocksBC6H((ispc::rgba_surface*)src, dst, (ispc::bc6h_enc_settings*)settings);
+}
+
+void CompressBlocksBC7Stats(const rgba_surface* src, uint8_t* dst, bc7_enc_settings* settings, bc7_enc_stats* stats)
+{
+	kernels->CompressBlocksBC7Stats((ispc::rgba_surface*)src, dst, (ispc::bc7_enc_settings*)settings, (ispc::bc7_enc_stats*)stats);
+}
+
+void CompressBlocksBC6HStats(const rgba_surface* src, uint8_t* dst, bc6h_enc_settings* settings, bc6h_enc_stats* stats)
+{
+    kernels->CompressBlocksBC6HStats((ispc::rgba_surface*)src, dst, (ispc::bc6h_enc_settings*)settings, (ispc::bc6h_enc_stats*)stats);
+}
+
+void CompressBlocksBC7Errors(const rgba_surface* src, uint8_t* dst, bc7_enc_settings* settings, bc7_enc_stats* stats, float* errors)
+{
+	kernels->CompressBlocksBC7Errors((ispc::rgba_surface*)src, dst, (ispc::bc7_enc_settings*)settings, (ispc::bc7_enc_stats*)stats, errors);
+}
+
+void CompressBlocksBC6HErrors(const rgba_surface* src, uint8_t* dst, bc6h_enc_settings* settings, bc6h_enc_stats* stats, float* errors)
+{
+    kernels->CompressBlocksBC6HErrors((ispc::rgba_surface*)src, dst, (ispc::bc6h_enc_settings*)settings, (ispc::bc6h_enc_stats*)stats, errors);
+}
+
+void CompressBlocksETC1(const rgba_surface* src, uint8_t* dst, etc_enc_settings* settings)
+{
+    kernels->CompressBlocksETC1((ispc::rgba_surface*)src, dst, (ispc::etc_enc_settings*)settings);
+}
@@ -1,122 +1,200 @@
-////////////////////////////////////////////////////////////////////////////////
-// Copyright (c) 2016-2019, Intel Corporation
-//
-// Permission is hereby granted, free of charge, to any person obtaining a copy
-// of this software and associated documentation files (the "Software"), to
-// deal in the Software without restriction, including without limitation the
-// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
-// sell copies of the Software, and to permit persons to whom the Software is
-// furnished to do so, subject to the following conditions:
-//
-// The above copyright notice and this permission notice shall be included in
-// all copies or substantial portions of the Software.
-//
-// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
-// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
-// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
-// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
-// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
-// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
-// IN THE SOFTWARE.
-////////////////////////////////////////////////////////////////////////////////
-
-#include <stdint.h>
-
-struct rgba_surface
-{
-    uint8_t* ptr;
-    int32_t width;
-    int32_t height;
-    int32_t stride; // in bytes
-};
-
-struct bc7_enc_settings
-{
-    bool mode_selection[4];
-    int refineIterations[8];
-
-    bool skip_mode2;
-    int fastSkipTreshold_mode1;
-    int fastSkipTreshold_mode3;
-    int fastSkipTreshold_mode7;
-
-    int mode45_channel0;
-    int refineIterations_channel;
-
-    int channels;
-};
-
-struct bc6h_enc_settings
-{
-    bool slow_mode;
-    bool fast_mode;
-    int refineIterations_1p;
-    int refineIterations_2p;
-    int fastSkipTreshold;
-};
-
-struct etc_enc_settings
-{
-    int fastSkipTreshold;
-};
-
-struct astc_enc_settings
-{
-    int block_width;
-    int block_height;
-    int channels;
-
-    int fastSkipTreshold;
-    int refineIterations;
-};
-
-// profiles for RGB data (alpha channel will be ignored)
-extern "C" void GetProfile_ultrafast(bc7_enc_settings* settings);
-extern "C" void GetProfile_veryfast(bc7_enc_settings* settings);
-extern "C" void GetProfile_fast(bc7_enc_settings* settings);
-extern "C" void GetProfile_basic(bc7_enc_settings* settings);
-extern "C" void GetProfile_slow(bc7_enc_settings* settings);
-
-// profiles for RGBA inputs
-extern "C" void GetProfile_alpha_ultrafast(bc7_enc_settings* settings);
-extern "C" void GetProfile_alpha_veryfast(bc7_enc_settings* settings);
-extern "C" void GetProfile_alpha_fast(bc7_enc_settings* settings);
-extern "C" void GetProfile_alpha_basic(bc7_enc_settings* settings);
-extern "C" void GetProfile_alpha_slow(bc7_enc_settings* settings);
-
-// profiles for BC6H (RGB HDR)
-extern "C" void GetProfile_bc6h_veryfast(bc6h_enc_settings* settings);
-extern "C" void GetProfile_bc6h_fast(bc6h_enc_settings* settings);
-extern "C" void GetProfile_bc6h_basic(bc6h_enc_settings* settings);
-extern "C" void GetProfile_bc6h_slow(bc6h_enc_settings* settings);
-extern "C" void GetProfile_bc6h_veryslow(bc6h_enc_settings* settings);
-
-// profiles for ETC
-extern "C" void GetProfile_etc_slow(etc_enc_settings* settings);
-
-// profiles for ASTC
-extern "C" void GetProfile_astc_fast(astc_enc_settings* settings, int block_width, int block_height);
-extern "C" void GetProfile_astc_alpha_fast(astc_enc_settings* settings, int block_width, int block_height);
-extern "C" void GetProfile_astc_alpha_slow(astc_enc_settings* settings, int block_width, int block_height);
-
-// helper function to replicate border pixels for the desired block sizes (bpp = 32 or 64)
-extern "C" void ReplicateBorders(rgba_surface* dst_slice, const rgba_surface* src_tex, int x, int y, int bpp);
-
-/*
-Notes:
-    - input width and height need to be a multiple of block size
-    - LDR input is 32 bit/pixel (sRGB), HDR is 64 bit/pixel (half float)
-    - dst buffer must be allocated with enough space for the compressed texture:
-        - 8 bytes/block for BC1/ETC1,
-        - 16 bytes/block for BC3/BC6H/BC7/ASTC
-    - the blocks are stored in raster scan order (natural CPU texture layout)
-    - use the GetProfile_* functions to select various speed/quality tradeoffs
-    - the RGB profiles are slightly faster as they ignore the alpha channel
-*/
-
-extern "C" void CompressBlocksBC1(const rgba_surface* src, uint8_t* dst);
-extern "C" void CompressBlocksBC3(const rgba_surface* src, uint8_t* dst);
-extern "C" void CompressBlocksBC6H(const rgba_surface* src, uint8_t* dst, bc6h_enc_settings* settings);
-extern "C" void CompressBlocksBC7(const rgba_surface* src, uint8_t* dst, bc7_enc_settings* settings);
-extern "C" void CompressBlocksETC1(const rgba_surface* src, uint8_t* dst, etc_enc_settings* settings);
-extern "C" void CompressBlocksASTC(const rgba_surface* src, uint8_t* dst, astc_enc_settings* settings);
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016-2019, Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+
+// incremented whenever a change to the kernels alters the compressed output
+#define ISPC_TEXCOMP_VERSION 2
+
+struct rgba_surface
+{
+    uint8_t* ptr;
+    int32_t width;
+    int32_t height;
+    int32_t stride; // in bytes
+};
+
+struct bc7_enc_settings
+{
+    bool mode_selection[4];
+    int refineIterations[8];
+
+    bool skip_mode2;
+    int fastSkipTreshold_mode1;
+    int fastSkipTreshold_mode3;
+    int fastSkipTreshold_mode7;
+
+    int mode45_channel0;
+    int refineIterations_channel;
+
+    int channels;
+};
+
+struct bc6h_enc_settings
+{
+    bool slow_mode;
+    bool fast_mode;
+    int refineIterations_1p;
+    int refineIterations_2p;
+    int fastSkipTreshold;
+};
+
+// optional encoder statistics, see CompressBlocksBC7Stats/CompressBlocksBC6HStats
+struct bc7_enc_stats
+{
+    int blocks;
+    int solid;                  // blocks coded by the single color path (as mode 5, also counted below)
+    int mode[8];                // blocks that chose each mode
+    int partition[8][64];       // ...per partition (modes 0, 1, 2, 3 and 7)
+    int rotation[8][4];         // ...per rotation as coded in the block (modes 4 and 5)
+    int candidates[8];          // partitions (modes 0-3, 7) or rotations (modes 4, 5) evaluated
+    int pruned[8];              // partitions skipped by fastSkipTreshold_* or skip_mode2
+    int refine_iterations[8];   // refinement iterations run
+    int refine_improved[8];     // refinement iterations that lowered the error
+};
+
+// modes are numbered from 0, mode n is bitstream mode n+1
+struct bc6h_enc_stats
+{
+    int blocks;
+    int solid;                  // blocks coded by the single color path (as mode 13, also counted below)
+    int mode[14];               // blocks that chose each mode
+    int partition[32];          // blocks that chose each partition (two region modes)
+    int mode_passed[14];        // blocks where the mode passed the endpoint span test
+    int mode_skipped[14];       // blocks where it failed (modes 2 and 6 stand for 2-4 and 6-8)
+    int candidates;             // two region partitions evaluated
+    int pruned;                 // partitions skipped by fastSkipTreshold
+    int refine_iterations[2];   // refinement iterations run (one region, two regions)
+    int refine_improved[2];     // refinement iterations that lowered the error
+};
+
+// content flags of an RGBA8 surface, see AnalyzeSurface
+struct surface_analysis
+{
+    int opaque;                 // every alpha is 255
+    int binary_alpha;           // every alpha is 0 or 255
+    int grayscale;              // r == g == b for every pixel
+    int blue_zero;              // b == 0 for every pixel
+};
+
+struct etc_enc_settings
+{
+    int fastSkipTreshold;
+};
+
+struct astc_enc_settings
+{
+    int block_width;
+    int block_height;
+    int channels;
+
+    int fastSkipTreshold;
+    int refineIterations;
+};
+
+// profiles for RGB data (alpha channel will be ignored)
+extern "C" void GetProfile_ultrafast(bc7_enc_settings* settings);
+extern "C" void GetProfile_veryfast(bc7_enc_settings* settings);
+extern "C" void GetProfile_fast(bc7_enc_settings* settings);
+extern "C" void GetProfile_basic(bc7_enc_settings* settings);
+extern "C" void GetProfile_slow(bc7_enc_settings* settings);
+
+// profiles for RGBA inputs
+extern "C" void GetProfile_alpha_ultrafast(bc7_enc_settings* settings);
+extern "C" void GetProfile_alpha_veryfast(bc7_enc_settings* settings);
+extern "C" void GetProfile_alpha_fast(bc7_enc_settings* settings);
+extern "C" void GetProfile_alpha_basic(bc7_enc_settings* settings);
+extern "C" void GetProfile_alpha_slow(bc7_enc_settings* settings);
+
+// profiles for BC6H (RGB HDR)
+extern "C" void GetProfile_bc6h_veryfast(bc6h_enc_settings* settings);
+extern "C" void GetProfile_bc6h_fast(bc6h_enc_settings* settings);
+extern "C" void GetProfile_bc6h_basic(bc6h_enc_settings* settings);
+extern "C" void GetProfile_bc6h_slow(bc6h_enc_settings* settings);
+extern "C" void GetProfile_bc6h_veryslow(bc6h_enc_settings* settings);
+
+// profiles for ETC
+extern "C" void GetProfile_etc_slow(etc_enc_settings* settings);
+
+// profiles for ASTC
+extern "C" void GetProfile_astc_fast(astc_enc_settings* settings, int block_width, int block_height);
+extern "C" void GetProfile_astc_alpha_fast(astc_enc_settings* settings, int block_width, int block_height);
+extern "C" void GetProfile_astc_alpha_slow(astc_enc_settings* settings, int block_width, int block_height);
+
+// helper function to replicate border pixels for the desired block sizes (bpp = 32 or 64)
+extern "C" void ReplicateBorders(rgba_surface* dst_slice, const rgba_surface* src_tex, int x, int y, int bpp);
+
+// scans an RGBA8 surface (any size) to find out which channels carry information, e.g. to pick
+// BC1 over BC3, BC4/BC5, or the RGB profiles for opaque input; result is overwritten
+extern "C" void AnalyzeSurface(const rgba_surface* src, surface_analysis* result);
+
+// the two passes of a separable resampling filter over RGBA float pixels (4 floats each),
+// e.g. for mipmap generation; index and weight hold taps entries per output sample
+//  - ResampleRow: dst pixel x = sum of weight[x * taps + t] * src pixel index[x * taps + t], for x < width
+//  - ResampleColumns: dst[k] = sum of weight[t] * src[index[t] * pitch + k], for k < count floats
+extern "C" void ResampleRow(const float* src, float* dst, int width, const int* index, const float* weight, int taps);
+extern "C" void ResampleColumns(const float* src, int pitch, float* dst, int count, const int* index, const float* weight, int taps);
+
+// target selection for the BC1-BC7 and ETC1 kernels (ASTC always uses ISPC's own dispatch)
+//  - isa names are "sse2", "sse4", "avx", "avx2", "avx512skx", "neon", or "auto" for ISPC's dispatch (the default)
+//  - SetTargetISA fails if the target is not compiled in or not supported by the CPU and keeps the current one,
+//    it is not thread safe and should be called before compressing
+//  - GetTargetISA returns the target the kernels run on, resolving "auto" to the dispatched variant
+//  - GetCompiledISAs returns the compiled in targets separated by commas
+extern "C" bool SetTargetISA(const char* isa);
+extern "C" const char* GetTargetISA();
+extern "C" const char* GetCompiledISAs();
+extern "C" bool IsTargetISASupported(const char* isa);
+
+/*
+Notes:
+    - input width and height need to be a multiple of block size
+    - LDR input is 32 bit/pixel (sRGB), HDR is 64 bit/pixel (half float)
+    - dst buffer must be allocated with enough space for the compressed texture:
+        - 8 bytes/block for BC1/BC4/ETC1,
+        - 16 bytes/block for BC3/BC5/BC6H/BC7/ASTC
+    - BC4 encodes the red channel, BC5 the red and green channels of LDR input
+    - the blocks are stored in raster scan order (natural CPU texture layout)
+    - use the GetProfile_* functions to select various speed/quality tradeoffs
+    - the RGB profiles are slightly faster as they ignore the alpha channel
+    - blocks of a single color skip the search and get a table based encoding (exact for
+      BC3 alpha/BC4/BC5/BC6H/BC7, within 1.33 per channel for BC1)
+    - the *Stats variants produce the same output and add the encoder statistics to stats
+      (which is not cleared), they are slower and meant for tuning the profiles
+    - the *Errors variants also write the squared error of each block (summed over its 16 pixels
+      and the encoded channels) to errors, width/4 * height/4 floats in raster order; stats may be NULL
+        - BC7 errors are in 8 bit units, BC6H errors in units of the half float bit patterns
+        - solid blocks report 0
+*/
+
+extern "C" void CompressBlocksBC1(const rgba_surface* src, uint8_t* dst);
+extern "C" void CompressBlocksBC3(const rgba_surface* src, uint8_t* dst);
+extern "C" void CompressBlocksBC4(const rgba_surface* src, uint8_t* dst);
+extern "C" void CompressBlocksBC5(const rgba_surface* src, uint8_t* dst);
+extern "C" void CompressBlocksBC6H(const rgba_surface* src, uint8_t* dst, bc6h_enc_settings* settings);
+extern "C" void CompressBlocksBC7(const rgba_surface* src, uint8_t* dst, bc7_enc_settings* settings);
+extern "C" void CompressBlocksBC6HStats(const rgba_surface* src, uint8_t* dst, bc6h_enc_settings* settings, bc6h_enc_stats* stats);
+extern "C" void CompressBlocksBC7Stats(const rgba_surface* src, uint8_t* dst, bc7_enc_settings* settings, bc7_enc_stats* stats);
+extern "C" void CompressBlocksBC6HErrors(const rgba_surface* src, uint8_t* dst, bc6h_enc_settings* settings, bc6h_enc_stats* stats, float* errors);
+extern "C" void CompressBlocksBC7Errors(const rgba_surface* src, uint8_t* dst, bc7_enc_settings* settings, bc7_enc_stats* stats, float* errors);
+extern "C" void CompressBlocksETC1(const rgba_surface* src, uint8_t* dst, etc_enc_settings* settings);
+extern "C" void CompressBlocksASTC(const rgba_surface* src, uint8_t* dst, astc_enc_settings* settings);
@@ -0,0 +1,373 @@
+﻿#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ispc_texcomp.h"
+#include "color_convert.h"
+#include "kernel_ispc.h"
+#include "kernel_astc_ispc.h"
+
+// ISAごとのエントリポイントの一覧。ISPCを複数のターゲットでビルドすると、各ターゲットの関数は
+// 名前の末尾にISAの名前が付いて残る。CMakeではDDSCONV_ISPC_TARGETSから生成したヘッダーを使い、
+// Visual StudioではReleaseの構成でispc_texcomp.vcxprojと同じ5つのターゲットを定義する。
+#if defined(KERNEL_BENCH_ISAS_HEADER)
+#include "kernel_bench_isas.h"
+#elif defined(KERNEL_BENCH_X86_ISAS)
+#define KERNEL_BENCH_ISAS(X) X(sse2) X(sse4) X(avx) X(avx2) X(avx512skx)
+#else
+#define KERNEL_BENCH_ISAS(X)
+#endif
+
+#define ABORT(msg) { puts(msg); return 1; }
+
+namespace {
+
+const char* kHelp =
+    "kernel_bench (ispc_texcomp v%d)\n"
+    "\n"
+    "使い方:\n"
+    "  kernel_bench [options]\n"
+    "\n"
+    "  ispc_texcompの内部の処理を1つずつ、固定のブロックの集合に対して実行し、\n"
+    "  ビルドに含まれるISAごとに1ブロックあたりの時間(ns/block)を出力します。\n"
+    "  autoは実行時のディスパッチを通した結果で、選ばれたISAを最初に表示します。\n"
+    "  load_blockはブロックの読み込みだけの時間で、ほかの結果にはこの時間が含まれます。\n"
+    "  load_block_stagedはBC1-BC5のエンコーダーが使う、ブロックの行をまとめて並べ替える読み込みで、\n"
+    "  bc1, bc3はそれを含むCompressBlocksBC1, BC3の全体の時間です。\n"
+    "\n"
+    "オプション:\n"
+    "  --kernel <text>\n"
+    "\t名前にtextを含む処理だけを計測します。\n"
+    "  --set <text>\n"
+    "\t名前にtextを含むブロックの集合だけを使います。gradient, noise, edges\n"
+    "  --size <pixels>\n"
+    "\tブロックの集合の幅と高さを指定します。64の倍数に切り上げます。初期値は256です。\n"
+    "  --iterations <count>\n"
+    "\t各組み合わせの実行回数を指定します。最短の時間を結果とします。初期値は5です。\n"
+    "  --json <file>\n"
+    "\t結果をJSONで書き出します。\n"
+    "  -h, --help\n"
+    "\tヘルプを表示します。\n";
+
+struct Options {
+    std::string kernel;
+    std::string set;
+    std::string json;
+    uint32_t size = 256;
+    uint32_t iterations = 5;
+};
+
+// 1つのISAのエントリポイント。
+struct KernelSet {
+    const char* isa;
+    int32_t (*programCount)();
+    void (*loadBlock)(ispc::rgba_surface*, float*);
+    void (*loadBlockStaged)(ispc::rgba_surface*, float*);
+    void (*compressBC1)(ispc::rgba_surface*, uint8_t*);
+    void (*compressBC3)(ispc::rgba_surface*, uint8_t*);
+    void (*blockPcaAxis)(ispc::rgba_surface*, int32_t, float*);
+    void (*blockSegment)(ispc::rgba_surface*, int32_t, float*);
+    void (*blockQuant)(ispc::rgba_surface*, int32_t, int32_t, uint32_t*, float*);
+    void (*optEndpoints)(ispc::rgba_surface*, int32_t, int32_t, uint32_t*, float*);
+    void (*bc7Mode01237)(ispc::rgba_surface*, ispc::bc7_enc_settings*, int32_t, int32_t, float*);
+    void (*bc7Mode45)(ispc::rgba_surface*, ispc::bc7_enc_settings*, float*);
+    void (*bc6h2pList)(ispc::rgba_surface*, ispc::bc6h_enc_settings*, int32_t, float*);
+    void (*astcRank)(ispc::rgba_surface*, int32_t, int32_t, uint32_t*, ispc::astc_enc_settings*);
+};
+
+#define KERNEL_BENCH_DECLARE(isa) \
+    extern "C" { \
+    int32_t get_programCount_##isa(); \
+    void Bench_load_block_ispc_##isa(ispc::rgba_surface*, float*); \
+    void Bench_load_block_staged_ispc_##isa(ispc::rgba_surface*, float*); \
+    void CompressBlocksBC1_ispc_##isa(ispc::rgba_surface*, uint8_t*); \
+    void CompressBlocksBC3_ispc_##isa(ispc::rgba_surface*, uint8_t*); \
+    void Bench_block_pca_axis_ispc_##isa(ispc::rgba_surface*, int32_t, float*); \
+    void Bench_block_segment_ispc_##isa(ispc::rgba_surface*, int32_t, float*); \
+    void Bench_block_quant_ispc_##isa(ispc::rgba_surface*, int32_t, int32_t, uint32_t*, float*); \
+    void Bench_opt_endpoints_ispc_##isa(ispc::rgba_surface*, int32_t, int32_t, uint32_t*, float*); \
+    void Bench_bc7_enc_mode01237_ispc_##isa(ispc::rgba_surface*, ispc::bc7_enc_settings*, int32_t, int32_t, float*); \
+    void Bench_bc7_enc_mode45_ispc_##isa(ispc::rgba_surface*, ispc::bc7_enc_settings*, float*); \
+    void Bench_bc6h_enc_2p_list_ispc_##isa(ispc::rgba_surface*, ispc::bc6h_enc_settings*, int32_t, float*); \
+    void astc_rank_ispc_##isa(ispc::rgba_surface*, int32_t, int32_t, uint32_t*, ispc::astc_enc_settings*); \
+    }
+KERNEL_BENCH_ISAS(KERNEL_BENCH_DECLARE)
+
+#define KERNEL_BENCH_SET(isa) { #isa, get_programCount_##isa, \
+    Bench_load_block_ispc_##isa, Bench_load_block_staged_ispc_##isa, \
+    CompressBlocksBC1_ispc_##isa, CompressBlocksBC3_ispc_##isa, Bench_block_pca_axis_ispc_##isa, Bench_block_segment_ispc_##isa, \
+    Bench_block_quant_ispc_##isa, Bench_opt_endpoints_ispc_##isa, Bench_bc7_enc_mode01237_ispc_##isa, \
+    Bench_bc7_enc_mode45_ispc_##isa, Bench_bc6h_enc_2p_list_ispc_##isa, astc_rank_ispc_##isa },
+
+// autoは実行時のディスパッチを通す。
+const KernelSet kKernelSets[] = {
+    { "auto", ispc::get_programCount,
+      ispc::Bench_load_block_ispc, ispc::Bench_load_block_staged_ispc,
+      ispc::CompressBlocksBC1_ispc, ispc::CompressBlocksBC3_ispc, ispc::Bench_block_pca_axis_ispc, ispc::Bench_block_segment_ispc,
+      ispc::Bench_block_quant_ispc, ispc::Bench_opt_endpoints_ispc, ispc::Bench_bc7_enc_mode01237_ispc,
+      ispc::Bench_bc7_enc_mode45_ispc, ispc::Bench_bc6h_enc_2p_list_ispc, ispc::astc_rank_ispc },
+    KERNEL_BENCH_ISAS(KERNEL_BENCH_SET)
+};
+
+// ISAがこのCPUで実行できるか。ISPCのディスパッチと同じ条件で判定する。
+bool isIsaSupported(const std::string& isa) {
+    return IsTargetISASupported(isa.c_str());
+}
+
+// 計測に使うブロックの集合。同じ内容をRGBA8とRGBA16Fで持つ。
+struct BlockSet {
+    std::string name;
+    std::vector<uint8_t> ldr;
+    std::vector<uint16_t> hdr;
+    rgba_surface ldrSurface;
+    rgba_surface hdrSurface;
+};
+
+// 乱数の種を固定して、実行ごとに同じブロックにする。
+std::vector<BlockSet> generateBlockSets(uint32_t size) {
+    std::vector<BlockSet> sets;
+    auto add = [&](const char* name, auto&& pixel) {
+        BlockSet set;
+        set.name = name;
+        set.ldr.resize((size_t)size * size * 4);
+        set.hdr.resize((size_t)size * size * 4);
+        for (uint32_t y = 0; y < size; ++y) {
+            for (uint32_t x = 0; x < size; ++x) {
+                float rgba[4];
+                pixel(x, y, rgba);
+                size_t i = ((size_t)y * size + x) * 4;
+                for (int c = 0; c < 4; ++c) {
+                    float v = std::min(std::max(rgba[c], 0.0f), 1.0f);
+                    set.ldr[i + c] = (uint8_t)std::lround(v * 255.0f);
+                    // HDRは明るさの幅を広げる。
+                    set.hdr[i + c] = util::floatToHalf(c < 3 ? v * v * 16.0f : 1.0f);
+                }
+            }
+        }
+        sets.push_back(std::move(set));
+    };
+
+    std::mt19937 random(12345);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    float inv = 1.0f / (float)(size - 1);
+
+    add("gradient", [&](uint32_t x, uint32_t y, float* rgba) {
+        rgba[0] = x * inv; rgba[1] = y * inv; rgba[2] = 1.0f - (x + y) * inv * 0.5f; rgba[3] = 1.0f - x * inv * 0.5f;
+    });
+    add("noise", [&](uint32_t, uint32_t, float* rgba) {
+        rgba[0] = unit(random); rgba[1] = unit(random); rgba[2] = unit(random); rgba[3] = unit(random);
+    });
+    // ブロックごとに向きの異なる境界で2色に分かれる。パーティションの探索が効く内容。
+    std::vector<float> colors(((size_t)size / 4) * (size / 4) * 9);
+    for (auto& v : colors) v = unit(random);
+    add("edges", [&](uint32_t x, uint32_t y, float* rgba) {
+        const float* c = &colors[((y / 4) * (size / 4) + x / 4) * 9];
+        float lx = (x & 3) - 1.5f, ly = (y & 3) - 1.5f;
+        float angle = c[8] * 6.2831853f;
+        int side = lx * std::cos(angle) + ly * std::sin(angle) > 0.0f ? 4 : 0;
+        rgba[0] = c[side]; rgba[1] = c[side + 1]; rgba[2] = c[side + 2]; rgba[3] = c[side + 3];
+    });
+
+    for (auto& set : sets) {
+        set.ldrSurface = { set.ldr.data(), (int32_t)size, (int32_t)size, (int32_t)size * 4 };
+        set.hdrSurface = { reinterpret_cast<uint8_t*>(set.hdr.data()), (int32_t)size, (int32_t)size, (int32_t)size * 8 };
+    }
+    return sets;
+}
+
+// 計測する処理1つ分。runはブロックの集合全体を1回処理する。
+struct Kernel {
+    std::string name;
+    uint32_t blockWidth = 4;
+    uint32_t blockHeight = 4;
+    std::function<void(const KernelSet&, BlockSet&)> run;
+};
+
+struct Result {
+    std::string kernel;
+    std::string set;
+    std::string isa;
+    double nsPerBlock;
+};
+
+std::vector<Kernel> makeKernels(std::vector<uint32_t>& qblocks, std::vector<uint8_t>& output, float* sink) {
+    std::vector<Kernel> kernels;
+    auto add = [&](std::string name, std::function<void(const KernelSet&, BlockSet&)> run) {
+        Kernel kernel;
+        kernel.name = std::move(name);
+        kernel.run = std::move(run);
+        kernels.push_back(std::move(kernel));
+    };
+    auto ldr = [](BlockSet& set) { return (ispc::rgba_surface*)&set.ldrSurface; };
+    auto hdr = [](BlockSet& set) { return (ispc::rgba_surface*)&set.hdrSurface; };
+
+    add("load_block", [=](const KernelSet& k, BlockSet& set) { k.loadBlock(ldr(set), sink); });
+    add("load_block_staged", [=](const KernelSet& k, BlockSet& set) { k.loadBlockStaged(ldr(set), sink); });
+    // 出力は16バイト/ブロックの大きさを確保しておき、BC1とBC3で共用する。
+    add("bc1", [=, &output](const KernelSet& k, BlockSet& set) {
+        output.resize((size_t)set.ldrSurface.width * set.ldrSurface.height);
+        k.compressBC1(ldr(set), output.data());
+    });
+    add("bc3", [=, &output](const KernelSet& k, BlockSet& set) {
+        output.resize((size_t)set.ldrSurface.width * set.ldrSurface.height);
+        k.compressBC3(ldr(set), output.data());
+    });
+    add("block_pca_axis", [=](const KernelSet& k, BlockSet& set) { k.blockPcaAxis(ldr(set), 4, sink); });
+    add("block_segment", [=](const KernelSet& k, BlockSet& set) { k.blockSegment(ldr(set), 4, sink); });
+    // block_quantの結果をopt_endpointsの入力に使うので、この順に実行する。
+    add("block_quant", [=, &qblocks](const KernelSet& k, BlockSet& set) {
+        qblocks.resize((size_t)set.ldrSurface.width / 4 * (set.ldrSurface.height / 4) * 2);
+        k.blockQuant(ldr(set), 2, 4, qblocks.data(), sink);
+    });
+    add("opt_endpoints", [=, &qblocks](const KernelSet& k, BlockSet& set) { k.optEndpoints(ldr(set), 2, 4, qblocks.data(), sink); });
+
+    bc7_enc_settings bc7;
+    GetProfile_alpha_basic(&bc7);
+    // モードごとのパーティション数はbc7_enc_mode02と同じで、1,3,7はすべてのパーティションを試す。
+    const std::pair<int, int> bc7Modes[] = { {0, 16}, {1, 64}, {2, 64}, {3, 64}, {7, 64} };
+    for (auto& mode : bc7Modes) {
+        add("bc7_enc_mode01237/mode" + std::to_string(mode.first), [=](const KernelSet& k, BlockSet& set) mutable {
+            k.bc7Mode01237(ldr(set), (ispc::bc7_enc_settings*)&bc7, mode.first, mode.second, sink);
+        });
+    }
+    add("bc7_enc_mode45", [=](const KernelSet& k, BlockSet& set) mutable {
+        k.bc7Mode45(ldr(set), (ispc::bc7_enc_settings*)&bc7, sink);
+    });
+
+    bc6h_enc_settings bc6h;
+    GetProfile_bc6h_basic(&bc6h);
+    add("bc6h_enc_2p_list", [=](const KernelSet& k, BlockSet& set) mutable {
+        k.bc6h2pList(hdr(set), (ispc::bc6h_enc_settings*)&bc6h, 32, sink);
+    });
+
+    for (int blockSize : { 4, 8 }) {
+        astc_enc_settings astc;
+        GetProfile_astc_alpha_fast(&astc, blockSize, blockSize);
+        auto name = "astc_rank_ispc/" + std::to_string(blockSize) + "x" + std::to_string(blockSize);
+        add(name, [=](const KernelSet& k, BlockSet& set) mutable {
+            // CompressBlocksASTCと同じく、programCount個のブロックずつ呼び出す。
+            int programCount = k.programCount();
+            std::vector<uint32_t> modeBuffer((size_t)programCount * astc.fastSkipTreshold);
+            int blocksX = set.ldrSurface.width / blockSize;
+            for (int yy = 0; yy < set.ldrSurface.height / blockSize; ++yy)
+                for (int xx = 0; xx < blocksX; xx += programCount)
+                    k.astcRank(ldr(set), xx, yy, modeBuffer.data(), (ispc::astc_enc_settings*)&astc);
+        });
+        kernels.back().blockWidth = (uint32_t)blockSize;
+        kernels.back().blockHeight = (uint32_t)blockSize;
+    }
+    return kernels;
+}
+
+int parseArguments(Options& options, int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-h" || arg == "--help") {
+            printf(kHelp, ISPC_TEXCOMP_VERSION);
+            return 1;
+        }
+        else if (arg == "--kernel" && hasValue) options.kernel = argv[++i];
+        else if (arg == "--set" && hasValue) options.set = argv[++i];
+        else if (arg == "--json" && hasValue) options.json = argv[++i];
+        else if (arg == "--size" && hasValue) options.size = (uint32_t)std::max(std::stoi(argv[++i]), 64);
+        else if (arg == "--iterations" && hasValue) options.iterations = (uint32_t)std::max(std::stoi(argv[++i]), 1);
+        else {
+            printf("Invalid option: %s\nUse --help for more information.\n", arg.c_str());
+            return 1;
+        }
+    }
+    // 8x8のASTCとprogramCountの倍数に揃える。
+    options.size = (options.size + 63) / 64 * 64;
+    return 0;
+}
+
+bool writeJson(const std::string& path, const Options& options, const std::vector<const KernelSet*>& isas, const std::vector<Result>& results) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"ispcTexcompVersion\": %d,\n", ISPC_TEXCOMP_VERSION);
+    fprintf(file, "  \"size\": %u,\n", options.size);
+    fprintf(file, "  \"iterations\": %u,\n", options.iterations);
+    fprintf(file, "  \"dispatchedIsa\": \"%s\",\n", GetTargetISA());
+    fprintf(file, "  \"isas\": [");
+    for (size_t i = 0; i < isas.size(); ++i)
+        fprintf(file, "%s{ \"name\": \"%s\", \"programCount\": %d }", i ? ", " : "", isas[i]->isa, isas[i]->programCount());
+    fprintf(file, "],\n");
+    fprintf(file, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto& r = results[i];
+        fprintf(file, "    { \"kernel\": \"%s\", \"set\": \"%s\", \"isa\": \"%s\", \"nsPerBlock\": %.3f }%s\n",
+                r.kernel.c_str(), r.set.c_str(), r.isa.c_str(), r.nsPerBlock, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+    fclose(file);
+    return true;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (parseArguments(options, argc, argv) != 0)
+        return 1;
+
+    std::vector<const KernelSet*> isas;
+    for (auto& set : kKernelSets) {
+        if (isIsaSupported(set.isa))
+            isas.push_back(&set);
+    }
+
+    auto blockSets = generateBlockSets(options.size);
+    std::vector<uint32_t> qblocks;
+    std::vector<uint8_t> output;
+    float sink[1] = {};
+    auto kernels = makeKernels(qblocks, output, sink);
+
+    printf("auto: %s\n", GetTargetISA());
+    printf("%-28s %-9s", "kernel (ns/block)", "set");
+    for (auto isa : isas)
+        printf(" %10s", (std::string(isa->isa) + " x" + std::to_string(isa->programCount())).c_str());
+    printf("\n");
+
+    using Clock = std::chrono::steady_clock;
+    std::vector<Result> results;
+    for (auto& set : blockSets) {
+        if (!options.set.empty() && set.name.find(options.set) == std::string::npos)
+            continue;
+        for (auto& kernel : kernels) {
+            if (!options.kernel.empty() && kernel.name.find(options.kernel) == std::string::npos)
+                continue;
+            double blocks = (double)(options.size / kernel.blockWidth) * (options.size / kernel.blockHeight);
+            printf("%-28s %-9s", kernel.name.c_str(), set.name.c_str());
+            for (auto isa : isas) {
+                // 1回目はキャッシュを温めるために捨てる。
+                kernel.run(*isa, set);
+                double best = 1e30;
+                for (uint32_t i = 0; i < options.iterations; ++i) {
+                    auto start = Clock::now();
+                    kernel.run(*isa, set);
+                    best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+                }
+                double ns = best * 1e9 / blocks;
+                printf(" %10.1f", ns);
+                results.push_back({ kernel.name, set.name, isa->isa, ns });
+            }
+            printf("\n");
+        }
+    }
+
+    if (!options.json.empty() && !writeJson(options.json, options, isas, results))
+        ABORT("Failed to write the JSON file.");
+    return 0;
+}
@@ -0,0 +1,41 @@
+﻿#include "block_cache.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace util {
+
+BlockCache::BlockCache(size_t capacity)
+    : mShardCapacity((capacity + kShardCount - 1) / kShardCount), mShards(new Shard[kShardCount]) {
+}
+
+bool BlockCache::find(uint64_t hash, const uint8_t* key, size_t keySize, uint8_t* block, size_t blockSize) {
+    auto& shard = getShard(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(hash);
+    if (it == shard.index.end()) return false;
+
+    // ハッシュ値が衝突した別のブロックは見つからなかったものとする。
+    auto& entry = shard.entries[it->second];
+    if (entry.keySize != keySize || entry.blockSize != blockSize || memcmp(entry.key, key, keySize) != 0)
+        return false;
+    memcpy(block, entry.block, blockSize);
+    return true;
+}
+
+void BlockCache::insert(uint64_t hash, const uint8_t* key, size_t keySize, const uint8_t* block, size_t blockSize) {
+    assert(keySize <= kMaxKeyBytes && blockSize <= kMaxBlockBytes);
+    auto& shard = getShard(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.entries.size() >= mShardCapacity) return;
+    if (!shard.index.emplace(hash, (uint32_t)shard.entries.size()).second) return;
+
+    shard.entries.emplace_back();
+    auto& entry = shard.entries.back();
+    entry.keySize = (uint8_t)keySize;
+    entry.blockSize = (uint8_t)blockSize;
+    memcpy(entry.key, key, keySize);
+    memcpy(entry.block, block, blockSize);
+}
+
+}
@@ -0,0 +1,56 @@
+﻿#ifndef BLOCK_CACHE_H__
+#define BLOCK_CACHE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace util {
+
+// 4x4ブロックの圧縮結果のキャッシュ。キーはブロックのピクセルと圧縮設定を表すバイト列で、
+// 値は圧縮後の8または16バイト。複数のスレッドから同時に使ってよい。
+// ハッシュ値でシャードに分けてロックし、容量に達した後は追加しない。
+class BlockCache {
+public:
+    static const size_t kMaxKeyBytes = 8 + 16 * 8;     // 設定の識別子 + RGBA16Fのピクセル
+    static const size_t kMaxBlockBytes = 16;
+
+    explicit BlockCache(size_t capacity);
+
+    BlockCache(BlockCache const&) = delete;
+    BlockCache& operator=(BlockCache const&) = delete;
+
+    // hashはキーのハッシュ値。見つかった場合はblockに書き込んでtrueを返す。
+    bool find(uint64_t hash, const uint8_t* key, size_t keySize, uint8_t* block, size_t blockSize);
+
+    // 同じハッシュ値のエントリが既にある場合は何もしない。
+    void insert(uint64_t hash, const uint8_t* key, size_t keySize, const uint8_t* block, size_t blockSize);
+
+private:
+    struct Entry {
+        uint8_t keySize;
+        uint8_t blockSize;
+        uint8_t key[kMaxKeyBytes];
+        uint8_t block[kMaxBlockBytes];
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, uint32_t> index;
+        std::vector<Entry> entries;
+    };
+
+    static const size_t kShardCount = 64;
+
+    Shard& getShard(uint64_t hash) noexcept { return mShards[(hash >> 58) % kShardCount]; }
+
+    size_t mShardCapacity;
+    std::unique_ptr<Shard[]> mShards;
+};
+
+}
+
+#endif
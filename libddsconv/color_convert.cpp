@@ -0,0 +1,126 @@
+﻿#include "color_convert.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace util {
+
+namespace {
+
+// 8bitの各値に対する変換結果。初回の呼び出し時に1度だけ作成する。
+struct Tables {
+    uint8_t unorm8[256];
+    uint8_t linear8[256];
+    uint16_t unorm16f[256];
+    uint16_t linear16f[256];
+
+    Tables() noexcept {
+        for (int i = 0; i < 256; ++i) {
+            double linear = srgbToLinear(i / 255.0);
+            unorm8[i] = (uint8_t)i;
+            linear8[i] = (uint8_t)std::lround(linear * 255.0);
+            unorm16f[i] = floatToHalf((float)(i / 255.0));
+            linear16f[i] = floatToHalf((float)linear);
+        }
+    }
+};
+
+const Tables& getTables() noexcept {
+    static const Tables tables;
+    return tables;
+}
+
+template <typename T>
+void convertRow(const uint8_t* src, T* dst, size_t width, PixelLayout layout, const T* colorTable, const T* alphaTable) noexcept {
+    size_t r = layout == PixelLayout::RGBA ? 0 : 2;
+    size_t b = 2 - r;
+    for (size_t x = 0; x < width; ++x, src += 4, dst += 4) {
+        // srcとdstが同じ領域の場合に備えて、書き込む前にすべて読み出す。
+        uint8_t cr = src[r], cg = src[1], cb = src[b];
+        uint8_t ca = layout == PixelLayout::BGRX ? 255 : src[3];
+        dst[0] = colorTable[cr];
+        dst[1] = colorTable[cg];
+        dst[2] = colorTable[cb];
+        dst[3] = alphaTable[ca];
+    }
+}
+
+}
+
+double srgbToLinear(double value) noexcept {
+    return value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+}
+
+double linearToSrgb(double value) noexcept {
+    return value <= 0.0031308 ? value * 12.92 : 1.055 * std::pow(value, 1.0 / 2.4) - 0.055;
+}
+
+uint16_t floatToHalf(float value) noexcept {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    // 範囲外とNaNは無限大にする。
+    if (exponent >= 31) return (uint16_t)(sign | 0x7c00);
+    if (exponent <= 0) {
+        if (exponent < -10) return (uint16_t)sign;
+        mantissa |= 0x800000;
+        uint32_t shift = (uint32_t)(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t mid = 1u << (shift - 1);
+        if (rest > mid || (rest == mid && (half & 1))) ++half;
+        return (uint16_t)(sign | half);
+    }
+
+    uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) ++half;
+    return (uint16_t)(sign | half);
+}
+
+float halfToFloat(uint16_t value) noexcept {
+    uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+
+    uint32_t bits;
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        }
+        else {
+            // 非正規化数は正規化してから変換する。
+            exponent = 127 - 15 + 1;
+            while (!(mantissa & 0x400)) {
+                mantissa <<= 1;
+                --exponent;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    }
+    else if (exponent == 31) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+void convertRowToRGBA8(const uint8_t* src, uint8_t* dst, size_t width, PixelLayout layout, bool srgbToLinear) noexcept {
+    auto& tables = getTables();
+    convertRow(src, dst, width, layout, srgbToLinear ? tables.linear8 : tables.unorm8, tables.unorm8);
+}
+
+void convertRowToRGBA16F(const uint8_t* src, uint16_t* dst, size_t width, PixelLayout layout, bool srgbToLinear) noexcept {
+    auto& tables = getTables();
+    convertRow(src, dst, width, layout, srgbToLinear ? tables.linear16f : tables.unorm16f, tables.unorm16f);
+}
+
+}
@@ -0,0 +1,29 @@
+﻿#ifndef COLOR_CONVERT_H__
+#define COLOR_CONVERT_H__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace util {
+
+// [0, 1]の値に対するsRGBとリニアの相互変換。
+double srgbToLinear(double value) noexcept;
+double linearToSrgb(double value) noexcept;
+
+// floatとhalf floatの相互変換。丸めは最近接偶数。
+uint16_t floatToHalf(float value) noexcept;
+float halfToFloat(uint16_t value) noexcept;
+
+// 8bit UNORMのピクセルの並び。BGRXのXは無視し、アルファを255として扱う。
+enum class PixelLayout { RGBA, BGRA, BGRX };
+
+// 8bit UNORMの1行をRGBA8に変換する。srgbToLinearを指定するとRGBをsRGBからリニアに変換する。
+// 1回の走査で並べ替えと色空間の変換を行う。srcとdstは同じ領域でもよい。
+void convertRowToRGBA8(const uint8_t* src, uint8_t* dst, size_t width, PixelLayout layout, bool srgbToLinear) noexcept;
+
+// 8bit UNORMの1行をRGBA16F(half float)に変換する。
+void convertRowToRGBA16F(const uint8_t* src, uint16_t* dst, size_t width, PixelLayout layout, bool srgbToLinear) noexcept;
+
+}
+
+#endif
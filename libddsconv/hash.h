@@ -0,0 +1,14 @@
+﻿#ifndef HASH_H__
+#define HASH_H__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace util {
+
+// XXH64互換の64bitハッシュ。
+uint64_t hash64(const void* data, size_t size, uint64_t seed = 0) noexcept;
+
+}
+
+#endif
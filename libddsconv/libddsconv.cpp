@@ -0,0 +1,150 @@
+﻿#include "libddsconv.h"
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#endif
+
+#include "pipeline.h"
+
+struct ddsconv_context {
+    explicit ddsconv_context(uint32_t threads) : pool(threads) { }
+
+    util::ThreadPool pool;
+    std::vector<ddsconv::Stage> stages = ddsconv::makeStages(pool);
+};
+
+namespace {
+
+bool applyOptions(ddsconv::Spec& spec, const ddsconv_options& options) {
+    switch (options.format) {
+      case DDSCONV_FORMAT_BC1:  spec.format = DXGI_FORMAT_BC1_UNORM; break;
+      case DDSCONV_FORMAT_BC3:  spec.format = DXGI_FORMAT_BC3_UNORM; break;
+      case DDSCONV_FORMAT_BC4:  spec.format = DXGI_FORMAT_BC4_UNORM; break;
+      case DDSCONV_FORMAT_BC5:  spec.format = DXGI_FORMAT_BC5_UNORM; break;
+      case DDSCONV_FORMAT_BC6H: spec.format = DXGI_FORMAT_BC6H_UF16; break;
+      case DDSCONV_FORMAT_BC7:  spec.format = DXGI_FORMAT_BC7_UNORM; break;
+      default: return false;
+    }
+    if (options.quality < DDSCONV_QUALITY_ULTRA_FAST || options.quality > DDSCONV_QUALITY_VERY_SLOW)
+        return false;
+    spec.level = (ddsconv::Level::Type)options.quality;
+
+    switch (options.mip_filter) {
+      case DDSCONV_MIP_FILTER_BOX:     spec.mipFilter = util::MipFilter::Box; break;
+      case DDSCONV_MIP_FILTER_KAISER:  spec.mipFilter = util::MipFilter::Kaiser; break;
+      case DDSCONV_MIP_FILTER_LANCZOS: spec.mipFilter = util::MipFilter::Lanczos; break;
+      default: return false;
+    }
+    spec.mipmapSpecified = options.mip_levels >= 0;
+    spec.mipLevels = spec.mipmapSpecified ? (uint32_t)options.mip_levels : 0;
+    spec.mipSrgbSpecified = options.mip_srgb != 0;
+    spec.linearColorSpecified = options.linear_color_space != 0;
+    spec.forceRgbSpecified = options.force_rgb != 0;
+    spec.dedupSpecified = options.dedup_blocks != 0;
+    spec.autoFormatSpecified = options.auto_format != 0;
+    spec.refinePsnr = std::max(options.refine_psnr, 0.0f);
+    spec.refinePercent = std::max(options.refine_percent, 0.0f);
+    if (options.cache_dir)
+        spec.cacheDir = options.cache_dir;
+    return true;
+}
+
+int fail(ddsconv_output* output, int result, const char* error) {
+    output->error = error;
+    return result;
+}
+
+}
+
+ddsconv_context* ddsconv_create_context(uint32_t threads) {
+    try {
+        return new ddsconv_context(threads);
+    }
+    catch (const std::exception&) {
+        return nullptr;
+    }
+}
+
+void ddsconv_destroy_context(ddsconv_context* context) {
+    delete context;
+}
+
+void ddsconv_get_default_options(ddsconv_options* options) {
+    if (!options) return;
+    *options = ddsconv_options();
+    options->format = DDSCONV_FORMAT_BC7;
+    options->quality = DDSCONV_QUALITY_ULTRA_FAST;
+    options->mip_levels = -1;
+    options->mip_filter = DDSCONV_MIP_FILTER_BOX;
+}
+
+int ddsconv_convert(ddsconv_context* context, const ddsconv_input* input,
+    const ddsconv_options* options, ddsconv_output* output) {
+    if (!output)
+        return DDSCONV_ERROR_INVALID_ARGUMENT;
+    output->data = nullptr;
+    output->size = 0;
+    output->error = nullptr;
+    if (!context || !input || !input->data || input->size == 0)
+        return fail(output, DDSCONV_ERROR_INVALID_ARGUMENT, "Invalid argument.");
+
+    ddsconv_options defaults;
+    ddsconv_get_default_options(&defaults);
+    ddsconv::Job job;
+    if (!applyOptions(job.spec, options ? *options : defaults))
+        return fail(output, DDSCONV_ERROR_INVALID_ARGUMENT, "Invalid options.");
+
+    job.sourceData = static_cast<const uint8_t*>(input->data);
+    job.sourceSize = input->size;
+    if (input->width != 0 || input->height != 0) {
+        size_t rowPitch = input->row_pitch != 0 ? input->row_pitch : (size_t)input->width * 4;
+        if (input->width == 0 || input->height == 0 || rowPitch < (size_t)input->width * 4 ||
+            input->size < rowPitch * (input->height - 1) + (size_t)input->width * 4)
+            return fail(output, DDSCONV_ERROR_INVALID_ARGUMENT, "Invalid pixel buffer.");
+        job.rawWidth = input->width;
+        job.rawHeight = input->height;
+        job.rawRowPitch = rowPitch;
+    }
+
+    // 呼び出し元の領域に収まらない場合のみallocateを使う。
+    bool tooSmall = false;
+    job.allocateOutput = [output, &tooSmall](size_t size) -> uint8_t* {
+        if (output->buffer && size <= output->capacity)
+            return static_cast<uint8_t*>(output->buffer);
+        void* data = output->allocate ? output->allocate(output->user_data, size) : nullptr;
+        tooSmall = !data;
+        return static_cast<uint8_t*>(data);
+    };
+
+#ifdef _WIN32
+    // WICによる読み込みにはCOMの初期化が必要。呼び出し元で初期化済みの場合はそのまま使う。
+    bool comInitialized = SUCCEEDED(CoInitializeEx(NULL, COINIT_MULTITHREADED));
+#endif
+    try {
+        for (auto& stage : context->stages) {
+            if (job.error || job.finished) break;
+            job.error = ddsconv::runStage(stage, job);
+        }
+    }
+    catch (const std::exception&) {
+        job.error = "Unexpected exception.";
+    }
+#ifdef _WIN32
+    if (comInitialized)
+        CoUninitialize();
+#endif
+
+    output->size = job.outputSize;
+    if (tooSmall)
+        return fail(output, DDSCONV_ERROR_BUFFER_TOO_SMALL, "The output buffer is too small.");
+    if (job.error)
+        return fail(output, DDSCONV_ERROR_FAILED, job.error);
+    output->data = job.outputData;
+    return DDSCONV_OK;
+}
@@ -0,0 +1,102 @@
+﻿#ifndef LIBDDSCONV_H__
+#define LIBDDSCONV_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ddsconvの変換処理をプロセス内から呼び出すためのAPI。
+// 入力は画像ファイルの内容またはRGBA8のピクセルで、出力のDDSファイルの内容はメモリ上に書き込まれる。
+// 1つのコンテキストを複数のスレッドから同時に使ってよい。
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum ddsconv_result {
+    DDSCONV_OK = 0,
+    DDSCONV_ERROR_INVALID_ARGUMENT = -1,
+    DDSCONV_ERROR_BUFFER_TOO_SMALL = -2,
+    DDSCONV_ERROR_FAILED = -3,
+};
+
+enum ddsconv_format {
+    DDSCONV_FORMAT_BC1,
+    DDSCONV_FORMAT_BC3,
+    DDSCONV_FORMAT_BC4,
+    DDSCONV_FORMAT_BC5,
+    DDSCONV_FORMAT_BC6H,
+    DDSCONV_FORMAT_BC7,
+};
+
+// コマンドラインの-qに対応する。
+enum ddsconv_quality {
+    DDSCONV_QUALITY_ULTRA_FAST,
+    DDSCONV_QUALITY_VERY_FAST,
+    DDSCONV_QUALITY_FAST,
+    DDSCONV_QUALITY_BASIC,
+    DDSCONV_QUALITY_SLOW,
+    DDSCONV_QUALITY_VERY_SLOW,
+};
+
+enum ddsconv_mip_filter {
+    DDSCONV_MIP_FILTER_BOX,
+    DDSCONV_MIP_FILTER_KAISER,
+    DDSCONV_MIP_FILTER_LANCZOS,
+};
+
+typedef struct ddsconv_options {
+    int format;                 // ddsconv_format
+    int quality;                // ddsconv_quality
+    int mip_levels;             // 負の値はミップマップなし、0はすべてのレベルを生成
+    int mip_filter;             // ddsconv_mip_filter
+    int mip_srgb;               // 0以外の場合はミップマップをリニア空間で縮小する
+    int linear_color_space;     // 0以外の場合は入力をリニア色空間として扱う
+    int force_rgb;              // 0以外の場合はRGBフォーマットを強制する
+    int dedup_blocks;           // 0以外の場合は同じ4x4ブロックの圧縮結果をプロセス内で使い回す
+    float refine_psnr;          // 0以外の場合、PSNRがこれを下回るBC6H/BC7のブロックを圧縮し直す
+    float refine_percent;       // 0以外の場合、誤差の大きい順にこの割合(%)のBC6H/BC7のブロックをサブリソースごとに圧縮し直す
+    int auto_format;            // 0以外の場合は画像の内容からBC1/BC4/BC5やRGBのプロファイルを自動で選ぶ。BC4/BC5では成分の意味が変わる
+    const wchar_t* cache_dir;   // 出力キャッシュのディレクトリ。NULLの場合は使用しない
+} ddsconv_options;
+
+typedef struct ddsconv_input {
+    const void* data;           // 画像ファイルの内容、またはRGBA8のピクセル
+    size_t size;                // dataのバイト数
+    uint32_t width;             // 0以外の場合、dataはwidth x heightのRGBA8のピクセル
+    uint32_t height;
+    size_t row_pitch;           // ピクセルの行の間隔。0の場合はwidth * 4
+} ddsconv_input;
+
+typedef struct ddsconv_output {
+    // 出力先。capacityが足りない場合はallocateを呼び出し、allocateがNULLの場合は
+    // DDSCONV_ERROR_BUFFER_TOO_SMALLを返す。allocateはNULLを返して失敗してよい。
+    void* buffer;
+    size_t capacity;
+    void* (*allocate)(void* user_data, size_t size);
+    void* user_data;
+
+    // 結果。dataは出力の先頭、sizeは必要なバイト数で、BUFFER_TOO_SMALLの場合も設定される。
+    // errorは失敗した場合のメッセージで、静的な文字列を指す。
+    void* data;
+    size_t size;
+    const char* error;
+} ddsconv_output;
+
+typedef struct ddsconv_context ddsconv_context;
+
+// threadsに0を指定した場合はハードウェアスレッド数を使用する。失敗した場合はNULLを返す。
+ddsconv_context* ddsconv_create_context(uint32_t threads);
+void ddsconv_destroy_context(ddsconv_context* context);
+
+// コマンドラインのデフォルトと同じ設定(BC7, ultrafast, ミップマップなし)で初期化する。
+void ddsconv_get_default_options(ddsconv_options* options);
+
+// 1枚の画像を変換する。戻り値はddsconv_result。
+int ddsconv_convert(ddsconv_context* context, const ddsconv_input* input,
+    const ddsconv_options* options, ddsconv_output* output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
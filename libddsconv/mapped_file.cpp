@@ -0,0 +1,89 @@
+﻿#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <filesystem>
+#endif
+
+namespace util {
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::create(const wchar_t* path, size_t size) {
+    close();
+
+    HANDLE file = ::CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    mFile = file;
+
+    uint64_t size64 = size;
+    mMapping = ::CreateFileMappingW(file, nullptr, PAGE_READWRITE, (DWORD)(size64 >> 32), (DWORD)size64, nullptr);
+    if (!mMapping) {
+        close();
+        return false;
+    }
+
+    mData = static_cast<uint8_t*>(::MapViewOfFile(mMapping, FILE_MAP_WRITE, 0, 0, size));
+    if (!mData) {
+        close();
+        return false;
+    }
+    mSize = size;
+    return true;
+}
+
+void MappedFile::close() noexcept {
+    if (mData) ::UnmapViewOfFile(mData);
+    if (mMapping) ::CloseHandle(mMapping);
+    if (mFile) ::CloseHandle(mFile);
+    mFile = nullptr;
+    mMapping = nullptr;
+    mData = nullptr;
+    mSize = 0;
+}
+
+#else
+
+bool MappedFile::create(const wchar_t* path, size_t size) {
+    close();
+
+    mFile = ::open(std::filesystem::path(path).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (mFile < 0) return false;
+
+    if (::ftruncate(mFile, (off_t)size) != 0) {
+        close();
+        return false;
+    }
+
+    void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFile, 0);
+    if (data == MAP_FAILED) {
+        close();
+        return false;
+    }
+    mData = static_cast<uint8_t*>(data);
+    mSize = size;
+    return true;
+}
+
+void MappedFile::close() noexcept {
+    if (mData) ::munmap(mData, mSize);
+    if (mFile >= 0) ::close(mFile);
+    mFile = -1;
+    mData = nullptr;
+    mSize = 0;
+}
+
+#endif
+
+}
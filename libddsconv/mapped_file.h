@@ -0,0 +1,40 @@
+#ifndef MAPPED_FILE_H__
+#define MAPPED_FILE_H__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace util {
+
+class MappedFile {
+public:
+    MappedFile() noexcept = default;
+    ~MappedFile();
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    bool create(const wchar_t* path, size_t size);
+
+    void close() noexcept;
+
+    bool isValid() const noexcept { return mData != nullptr; }
+
+    size_t getSize() const noexcept { return mSize; }
+
+    uint8_t* getData() const noexcept { return mData; }
+
+private:
+#ifdef _WIN32
+    void* mFile = nullptr;
+    void* mMapping = nullptr;
+#else
+    int mFile = -1;
+#endif
+    uint8_t* mData = nullptr;
+    size_t mSize = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,208 @@
+﻿#include "mipmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "color_convert.h"
+#include "ispc_texcomp.h"
+
+namespace util {
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+
+// 窓関数付きsincの半径(縮小後のピクセル単位)とKaiser窓のパラメータ。
+const double kSincRadius = 3.0;
+const double kKaiserAlpha = 4.0;
+
+double sinc(double x) noexcept {
+    if (std::abs(x) < 1e-6) return 1.0;
+    return std::sin(kPi * x) / (kPi * x);
+}
+
+// 0次の第1種変形ベッセル関数。
+double besselI0(double x) noexcept {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) break;
+    }
+    return sum;
+}
+
+double getRadius(MipFilter filter) noexcept {
+    return filter == MipFilter::Box ? 0.5 : kSincRadius;
+}
+
+double evaluate(MipFilter filter, double x) noexcept {
+    switch (filter) {
+      case MipFilter::Box:
+        return std::abs(x) < 0.5 ? 1.0 : 0.0;
+      case MipFilter::Kaiser: {
+        double t = x / kSincRadius;
+        if (t * t >= 1.0) return 0.0;
+        return sinc(x) * besselI0(kKaiserAlpha * std::sqrt(1.0 - t * t)) / besselI0(kKaiserAlpha);
+      }
+      case MipFilter::Lanczos:
+        if (std::abs(x) >= kSincRadius) return 0.0;
+        return sinc(x) * sinc(x / kSincRadius);
+    }
+    return 0.0;
+}
+
+// 1軸分のフィルタ係数。出力の各ピクセルはtaps個の入力ピクセルの重み付き和になる。
+// 積和はispc_texcompのResampleRow,ResampleColumnsで行うので、インデックスはintで持つ。
+struct Kernel {
+    size_t taps = 0;
+    std::vector<int> index;
+    std::vector<float> weight;
+};
+
+// 出力の[first, first + count)の範囲の係数を求める。範囲外の入力は端のピクセルで置き換える。
+void makeKernel(Kernel& kernel, size_t srcSize, size_t dstSize, size_t first, size_t count, MipFilter filter) {
+    double scale = (double)srcSize / (double)dstSize;
+    double radius = getRadius(filter) * scale;
+    kernel.taps = (size_t)std::ceil(radius * 2.0) + 1;
+    kernel.index.assign(count * kernel.taps, 0);
+    kernel.weight.assign(count * kernel.taps, 0.0f);
+
+    for (size_t i = 0; i < count; ++i) {
+        double center = (double)(first + i + 0.5) * scale;
+        ptrdiff_t begin = (ptrdiff_t)std::floor(center - radius);
+        double total = 0.0;
+        for (size_t t = 0; t < kernel.taps; ++t) {
+            ptrdiff_t x = begin + (ptrdiff_t)t;
+            double w = evaluate(filter, ((double)x + 0.5 - center) / scale);
+            kernel.index[i * kernel.taps + t] = (int)std::clamp<ptrdiff_t>(x, 0, (ptrdiff_t)srcSize - 1);
+            kernel.weight[i * kernel.taps + t] = (float)w;
+            total += w;
+        }
+        for (size_t t = 0; t < kernel.taps; ++t)
+            kernel.weight[i * kernel.taps + t] = (float)(kernel.weight[i * kernel.taps + t] / total);
+    }
+}
+
+// 8bit値とリニアの変換テーブル。リニアからの変換は16bitに量子化して引く。
+struct Tables {
+    float unormToFloat[256];
+    float srgbToFloat[256];
+    uint8_t floatToSrgb[65536];
+
+    Tables() noexcept {
+        for (int i = 0; i < 256; ++i) {
+            unormToFloat[i] = (float)(i / 255.0);
+            srgbToFloat[i] = (float)srgbToLinear(i / 255.0);
+        }
+        for (int i = 0; i < 65536; ++i)
+            floatToSrgb[i] = (uint8_t)std::lround(linearToSrgb(i / 65535.0) * 255.0);
+    }
+};
+
+const Tables& getTables() noexcept {
+    static const Tables tables;
+    return tables;
+}
+
+void decodeRow(const Image& src, size_t y, bool srgb, float* out) noexcept {
+    size_t count = src.getWidth() * 4;
+    if (src.getBytesPerPixel() == 8) {
+        auto p = static_cast<const uint16_t*>(src.getPixelRef(0, y));
+        for (size_t i = 0; i < count; ++i)
+            out[i] = halfToFloat(p[i]);
+    }
+    else {
+        auto& tables = getTables();
+        auto color = srgb ? tables.srgbToFloat : tables.unormToFloat;
+        auto p = static_cast<const uint8_t*>(src.getPixelRef(0, y));
+        for (size_t i = 0; i < count; i += 4) {
+            out[i + 0] = color[p[i + 0]];
+            out[i + 1] = color[p[i + 1]];
+            out[i + 2] = color[p[i + 2]];
+            out[i + 3] = tables.unormToFloat[p[i + 3]];
+        }
+    }
+}
+
+void encodeRow(const float* in, const Image& dst, size_t y, bool srgb) noexcept {
+    size_t count = dst.getWidth() * 4;
+    if (dst.getBytesPerPixel() == 8) {
+        // BC6H_UF16は負の値を表せないので、フィルタのリンギングで生じた負の値は0にする。
+        auto p = static_cast<uint16_t*>(dst.getPixelRef(0, y));
+        for (size_t i = 0; i < count; ++i)
+            p[i] = floatToHalf(std::max(in[i], 0.0f));
+    }
+    else {
+        auto& tables = getTables();
+        auto p = static_cast<uint8_t*>(dst.getPixelRef(0, y));
+        for (size_t i = 0; i < count; ++i) {
+            float v = std::clamp(in[i], 0.0f, 1.0f);
+            if (srgb && (i & 3) != 3)
+                p[i] = tables.floatToSrgb[(int)(v * 65535.0f + 0.5f)];
+            else
+                p[i] = (uint8_t)(v * 255.0f + 0.5f);
+        }
+    }
+}
+
+// 作業領域。スレッドごとに使い回す。
+thread_local Kernel tlsColumns;
+thread_local Kernel tlsRows;
+thread_local std::vector<float> tlsDecoded;
+thread_local std::vector<float> tlsFiltered;
+thread_local std::vector<float> tlsResult;
+thread_local std::vector<int> tlsTapIndex;
+thread_local std::vector<float> tlsTapWeight;
+
+}
+
+void downsampleRows(const Image& src, const Image& dst, size_t firstRow, size_t numRows, MipFilter filter, bool srgb) {
+    if (numRows == 0) return;
+    srgb = srgb && src.getBytesPerPixel() == 4;
+
+    size_t dstWidth = dst.getWidth();
+    auto& columns = tlsColumns;
+    auto& rows = tlsRows;
+    makeKernel(columns, src.getWidth(), dstWidth, 0, dstWidth, filter);
+    makeKernel(rows, src.getHeight(), dst.getHeight(), firstRow, numRows, filter);
+
+    // 必要な入力行を横方向にフィルタリングしておき、縦方向はその結果から求める。
+    size_t srcFirst = (size_t)*std::min_element(rows.index.begin(), rows.index.end());
+    size_t srcLast = (size_t)*std::max_element(rows.index.begin(), rows.index.end());
+    size_t rowFloats = dstWidth * 4;
+
+    auto& decoded = tlsDecoded;
+    auto& filtered = tlsFiltered;
+    auto& result = tlsResult;
+    decoded.resize(src.getWidth() * 4);
+    filtered.resize((srcLast - srcFirst + 1) * rowFloats);
+    result.resize(rowFloats);
+
+    for (size_t y = srcFirst; y <= srcLast; ++y) {
+        decodeRow(src, y, srgb, decoded.data());
+        ResampleRow(decoded.data(), &filtered[(y - srcFirst) * rowFloats], (int)dstWidth, columns.index.data(),
+                    columns.weight.data(), (int)columns.taps);
+    }
+
+    // 縦方向は出力行ごとにタップが共通なので、重みが0のタップを除いてfilteredの行番号に直して渡す。
+    auto& tapIndex = tlsTapIndex;
+    auto& tapWeight = tlsTapWeight;
+    for (size_t i = 0; i < numRows; ++i) {
+        tapIndex.clear();
+        tapWeight.clear();
+        for (size_t t = 0; t < rows.taps; ++t) {
+            float w = rows.weight[i * rows.taps + t];
+            if (w == 0.0f) continue;
+            tapIndex.push_back(rows.index[i * rows.taps + t] - (int)srcFirst);
+            tapWeight.push_back(w);
+        }
+        ResampleColumns(filtered.data(), (int)rowFloats, result.data(), (int)rowFloats, tapIndex.data(), tapWeight.data(),
+                        (int)tapIndex.size());
+        encodeRow(result.data(), dst, firstRow + i, srgb);
+    }
+}
+
+}
@@ -0,0 +1,23 @@
+﻿#ifndef MIPMAP_H__
+#define MIPMAP_H__
+
+#include <cstddef>
+
+#include "image.h"
+
+namespace util {
+
+enum class MipFilter {
+    Box,
+    Kaiser,
+    Lanczos,
+};
+
+// srcを縦横それぞれ半分(最小1)に縮小した画像dstのうち、[firstRow, firstRow + numRows)の行を生成する。
+// ピクセルは32bitならRGBA8、64bitならRGBA16F。srgbを指定するとRGBA8のRGBをリニアに変換してからフィルタリングする。
+// 行範囲が重ならなければ、複数のスレッドから同時に呼び出してよい。
+void downsampleRows(const Image& src, const Image& dst, size_t firstRow, size_t numRows, MipFilter filter, bool srgb);
+
+}
+
+#endif
@@ -0,0 +1,2173 @@
+﻿#include "pipeline.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cwctype>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <wincodec.h>
+#include <wrl/client.h>
+#endif
+
+#include "ispc_texcomp.h"
+#include "block_cache.h"
+#include "color_convert.h"
+#include "hash.h"
+#include "image.h"
+#include "trace.h"
+#ifndef _WIN32
+#include "stb_loader.h"
+#endif
+
+#define ROUNDUP(x,n) ((((x)+(n)-1)/(n))*(n))
+
+namespace ddsconv {
+
+namespace {
+
+DXGI_FORMAT getTargetFormat(const Spec& spec) {
+    return spec.format != DXGI_FORMAT_BC6H_UF16 ? DXGI_FORMAT_R8G8B8A8_UNORM : DXGI_FORMAT_R16G16B16A16_FLOAT;
+}
+
+bool shouldConvertImage(const Spec& spec, const DirectX::TexMetadata& meta) {
+    return getTargetFormat(spec) != meta.format;
+}
+
+// convertImage8で変換できる8bit UNORMのフォーマットならピクセルの並びを返す。
+bool getPixelLayout(DXGI_FORMAT format, util::PixelLayout& layout) {
+    switch (format) {
+      case DXGI_FORMAT_R8G8B8A8_UNORM: layout = util::PixelLayout::RGBA; return true;
+      case DXGI_FORMAT_B8G8R8A8_UNORM: layout = util::PixelLayout::BGRA; return true;
+      case DXGI_FORMAT_B8G8R8X8_UNORM: layout = util::PixelLayout::BGRX; return true;
+      default: return false;
+    }
+}
+
+bool readFile(const std::filesystem::path& path, std::vector<uint8_t>& bytes) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) return false;
+    bytes.resize((size_t)file.tellg());
+    file.seekg(0);
+    return (bool)file.read((char*)bytes.data(), (std::streamsize)bytes.size());
+}
+
+// dataがnullptrでない場合は、ファイルの代わりにメモリ上の画像ファイルの内容を読み込む。
+std::unique_ptr<DirectX::ScratchImage> loadImage(const Spec& spec, const uint8_t* data, size_t size) {
+    auto images = std::make_unique<DirectX::ScratchImage>();
+    DirectX::TexMetadata meta;
+    if (!(data ? loadImageFromMemory(data, size, meta, *images) : loadImageFromFile(spec.source, meta, *images)))
+        return nullptr;
+
+    // リニアカラー変換を指定されているが、画像のコンバートが必要ない場合。
+    // DirectX::Convertは元のフォーマットと変換後のフォーマットが同じ場合は失敗を返す。
+    // 色空間の変換のみを行うために、一度別のフォーマットに変更しておく。
+    // 8bit UNORMの画像はconvertImageが自前で変換するので不要。
+    util::PixelLayout layout;
+    if (spec.linearColorSpecified && !shouldConvertImage(spec, meta) && !getPixelLayout(meta.format, layout)) {
+        auto result = std::make_unique<DirectX::ScratchImage>();
+        if (FAILED(DirectX::Convert(images->GetImages(), images->GetImageCount(), images->GetMetadata(), DXGI_FORMAT_B8G8R8A8_UNORM, 
+                                    DirectX::TEX_FILTER_DEFAULT, DirectX::TEX_THRESHOLD_DEFAULT, *result))) {
+            return nullptr;
+        }
+        images = std::move(result);
+    }
+    return images;
+}
+
+// 1バンドあたりの入力サイズの目安。L2キャッシュに収まる程度にしておく。
+const size_t kBandBytes = 256 * 1024;
+
+// 並べ替えとsRGBのデコードを1回の走査で行う。各画像を行単位のバンドに分割して並列に処理する。
+std::unique_ptr<DirectX::ScratchImage> convertImage8(util::ThreadPool& pool, const Spec& spec,
+                                                     const DirectX::ScratchImage& images, util::PixelLayout layout) {
+    DXGI_FORMAT format = getTargetFormat(spec);
+    auto meta = images.GetMetadata();
+    meta.format = format;
+    auto result = std::make_unique<DirectX::ScratchImage>();
+    if (FAILED(result->Initialize(meta)))
+        return nullptr;
+
+    struct Band {
+        const DirectX::Image* src;
+        const DirectX::Image* dst;
+        size_t firstRow;
+        size_t numRows;
+    };
+    std::vector<Band> bands;
+    for (size_t i = 0; i < images.GetImageCount(); ++i) {
+        auto src = &images.GetImages()[i];
+        auto dst = &result->GetImages()[i];
+        size_t bandRows = std::max(kBandBytes / src->rowPitch, (size_t)1);
+        for (size_t row = 0; row < src->height; row += bandRows)
+            bands.push_back({ src, dst, row, std::min(bandRows, src->height - row) });
+    }
+
+    bool srgbToLinear = spec.linearColorSpecified;
+    pool.parallelFor(bands.size(), [&](size_t i) {
+        auto& band = bands[i];
+        util::TraceScope scope("convert", "task");
+        for (size_t row = band.firstRow; row < band.firstRow + band.numRows; ++row) {
+            auto src = band.src->pixels + row * band.src->rowPitch;
+            auto dst = band.dst->pixels + row * band.dst->rowPitch;
+            if (format == DXGI_FORMAT_R16G16B16A16_FLOAT)
+                util::convertRowToRGBA16F(src, (uint16_t*)dst, band.src->width, layout, srgbToLinear);
+            else
+                util::convertRowToRGBA8(src, dst, band.src->width, layout, srgbToLinear);
+        }
+    });
+    return result;
+}
+
+std::unique_ptr<DirectX::ScratchImage> convertImage(util::ThreadPool& pool, const Spec& spec, std::unique_ptr<DirectX::ScratchImage> images) {
+    util::PixelLayout layout;
+    if (getPixelLayout(images->GetMetadata().format, layout))
+        return convertImage8(pool, spec, *images, layout);
+
+    DXGI_FORMAT format = getTargetFormat(spec);
+    uint32_t filter = DirectX::TEX_FILTER_DEFAULT;
+    if (spec.linearColorSpecified) {
+        filter |= DirectX::TEX_FILTER_SRGB_IN;
+    }
+    auto result = std::make_unique<DirectX::ScratchImage>();
+    HRESULT hr = DirectX::Convert(images->GetImages(), images->GetImageCount(), images->GetMetadata(),
+                                  format, filter, DirectX::TEX_THRESHOLD_DEFAULT, *result);
+    if (FAILED(hr))
+        return nullptr;
+    return result;
+}
+
+const char* getFormatName(DXGI_FORMAT format) {
+    switch (format) {
+      case DXGI_FORMAT_BC1_UNORM: return "bc1";
+      case DXGI_FORMAT_BC3_UNORM: return "bc3";
+      case DXGI_FORMAT_BC4_UNORM: return "bc4";
+      case DXGI_FORMAT_BC5_UNORM: return "bc5";
+      case DXGI_FORMAT_BC6H_UF16: return "bc6h";
+      case DXGI_FORMAT_BC7_UNORM: return "bc7";
+      default: return "?";
+    }
+}
+
+// RGBA8の全画像を行単位のバンドに分割して並列に解析し、結果をまとめる。
+surface_analysis analyzeImages(util::ThreadPool& pool, const DirectX::ScratchImage& images) {
+    std::vector<rgba_surface> bands;
+    for (size_t i = 0; i < images.GetImageCount(); ++i) {
+        auto& image = images.GetImages()[i];
+        size_t bandRows = std::max(kBandBytes / image.rowPitch, (size_t)1);
+        for (size_t row = 0; row < image.height; row += bandRows) {
+            bands.push_back({ image.pixels + row * image.rowPitch, (int32_t)image.width,
+                              (int32_t)std::min(bandRows, image.height - row), (int32_t)image.rowPitch });
+        }
+    }
+
+    std::vector<surface_analysis> results(bands.size());
+    pool.parallelFor(bands.size(), [&](size_t i) {
+        util::TraceScope scope("analyze", "task");
+        AnalyzeSurface(&bands[i], &results[i]);
+    });
+
+    surface_analysis total = { 1, 1, 1, 1 };
+    for (auto& result : results) {
+        total.opaque &= result.opaque;
+        total.binary_alpha &= result.binary_alpha;
+        total.grayscale &= result.grayscale;
+        total.blue_zero &= result.blue_zero;
+    }
+    return total;
+}
+
+// --autoFormat。解析結果から、指定されたフォーマットより小さいか速い設定を選ぶ。
+// アルファを使わない画像(不透明、BC1、BC7の--forceRgb)では、グレースケールはBC4、青が0ならBC5、
+// BC3はBC1、BC7はRGBのプロファイルにする。BC1からBC5はサイズが増えるので選ばない。
+// BC1とRGBのプロファイルは読み出される値を変えないが、BC4とBC5は成分の意味が変わる。
+// BC4はRだけを持ち、GとBは0として読み出されるので、グレースケールとして使うにはRを複製して読む必要がある。
+// BC5はRとGだけを持ち、sRGBのフォーマットもない。
+// ISPCのBC1は1bitアルファの透過モードを使わないので、1bitアルファのBC3はそのままにする。
+// 選んだ内容を--verboseで表示する1行を返す。BC4とBC5の場合は成分が変わることも示す。
+std::string chooseFormat(Spec& spec, const surface_analysis& analysis) {
+    std::string content;
+    auto add = [&content](const char* name) {
+        content += content.empty() ? name : std::string(" ") + name;
+    };
+    if (analysis.opaque)
+        add("opaque");
+    else if (analysis.binary_alpha)
+        add("1-bit-alpha");
+    if (analysis.grayscale)
+        add("grayscale");
+    else if (analysis.blue_zero)
+        add("two-channel");
+    if (content.empty())
+        add("rgba");
+
+    auto requested = spec.format;
+    bool forceRgb = spec.forceRgbSpecified && spec.format == DXGI_FORMAT_BC7_UNORM;
+    bool opaque = analysis.opaque || spec.format == DXGI_FORMAT_BC1_UNORM || forceRgb;
+    if (opaque && analysis.grayscale)
+        spec.format = DXGI_FORMAT_BC4_UNORM;
+    else if (opaque && analysis.blue_zero && spec.format != DXGI_FORMAT_BC1_UNORM)
+        spec.format = DXGI_FORMAT_BC5_UNORM;
+    else if (opaque && spec.format == DXGI_FORMAT_BC3_UNORM)
+        spec.format = DXGI_FORMAT_BC1_UNORM;
+    else if (opaque && spec.format == DXGI_FORMAT_BC7_UNORM)
+        spec.forceRgbSpecified = true;
+
+    const char* note = "";
+    if (spec.format == DXGI_FORMAT_BC7_UNORM && spec.forceRgbSpecified)
+        note = " (rgb)";
+    else if (spec.format == DXGI_FORMAT_BC4_UNORM)
+        note = " (channels change: R only, G and B read as 0)";
+    else if (spec.format == DXGI_FORMAT_BC5_UNORM)
+        note = " (channels change: R and G only, no sRGB)";
+
+    char line[160];
+    snprintf(line, sizeof(line), "auto format: %s, %s -> %s%s", content.c_str(), getFormatName(requested),
+             getFormatName(spec.format), note);
+    return line;
+}
+
+bool isMipSrgb(const Spec& spec) {
+    return spec.mipSrgbSpecified && !spec.linearColorSpecified;
+}
+
+// 2D画像とキューブマップのミップマップは圧縮と並行して生成する(compressMipChain)。
+// それ以外はDirectXTexで事前にすべてのレベルを生成する。
+bool shouldFuseMipmaps(const Spec& spec, const DirectX::TexMetadata& meta) {
+    return spec.mipmapSpecified && meta.dimension != DirectX::TEX_DIMENSION_TEXTURE3D;
+}
+
+size_t getMipLevelCount(const DirectX::TexMetadata& meta, uint32_t mipLevels) {
+    size_t count = 1;
+    for (size_t size = std::max(meta.width, meta.height); size > 1; size >>= 1)
+        ++count;
+    return mipLevels == 0 ? count : std::min((size_t)mipLevels, count);
+}
+
+std::unique_ptr<DirectX::ScratchImage> generateMipmaps(std::unique_ptr<DirectX::ScratchImage> images, const Spec& spec) {
+    auto& meta = images->GetMetadata();
+    uint32_t filter = spec.mipFilter == util::MipFilter::Box ? DirectX::TEX_FILTER_DEFAULT : DirectX::TEX_FILTER_CUBIC;
+    if (isMipSrgb(spec)) {
+        filter |= DirectX::TEX_FILTER_SRGB;
+    }
+    auto mipChain = std::make_unique<DirectX::ScratchImage>();
+    if (meta.dimension == DirectX::TEX_DIMENSION_TEXTURE3D) {
+        if (FAILED(DirectX::GenerateMipMaps3D(images->GetImages(), images->GetImageCount(), meta, filter, spec.mipLevels, *mipChain))) {
+            return nullptr;
+        }
+    }
+    else {
+        if (FAILED(DirectX::GenerateMipMaps(images->GetImages(), images->GetImageCount(), meta, filter, spec.mipLevels, *mipChain))) {
+            return nullptr;
+        }
+    }
+    return mipChain;
+}
+
+// 圧縮後のテクスチャのメタデータ。
+DirectX::TexMetadata getOutputMetadata(DXGI_FORMAT format, const DirectX::TexMetadata& meta) {
+    DirectX::TexMetadata newMeta = meta;
+    newMeta.format = format;
+    newMeta.miscFlags &= DirectX::TEX_MISC_TEXTURECUBE;
+    newMeta.miscFlags2 = 0;
+    return newMeta;
+}
+
+// DDSファイルと同じ並びでサブリソースをbaseから配置し、全体のサイズを返す。
+// imagesはTexMetadata::ComputeIndexの順に並ぶ。baseにnullptrを渡すとサイズだけを求められる。
+size_t layoutImages(const DirectX::TexMetadata& meta, uint8_t* base, std::vector<DirectX::Image>& images) {
+    images.clear();
+    size_t offset = 0;
+    auto append = [&](size_t mip) {
+        DirectX::Image image = {};
+        image.width = std::max(meta.width >> mip, (size_t)1);
+        image.height = std::max(meta.height >> mip, (size_t)1);
+        image.format = meta.format;
+        DirectX::ComputePitch(meta.format, image.width, image.height, image.rowPitch, image.slicePitch);
+        image.pixels = base ? base + offset : nullptr;
+        images.push_back(image);
+        offset += image.slicePitch;
+    };
+
+    if (meta.dimension == DirectX::TEX_DIMENSION_TEXTURE3D) {
+        for (size_t mip = 0; mip < meta.mipLevels; ++mip) {
+            for (size_t slice = 0, depth = std::max(meta.depth >> mip, (size_t)1); slice < depth; ++slice)
+                append(mip);
+        }
+    }
+    else {
+        for (size_t item = 0; item < meta.arraySize; ++item) {
+            for (size_t mip = 0; mip < meta.mipLevels; ++mip)
+                append(mip);
+        }
+    }
+    return offset;
+}
+
+void initBC6HProfile(bc6h_enc_settings* settings, Level::Type level) {
+    switch (level) {
+    case Level::ULTRA_FAST: GetProfile_bc6h_veryfast(settings); break;
+    case Level::VERY_FAST:  GetProfile_bc6h_veryfast(settings); break;
+    case Level::FAST:       GetProfile_bc6h_fast(settings); break;
+    case Level::BASIC:      GetProfile_bc6h_basic(settings); break;
+    case Level::SLOW:       GetProfile_bc6h_slow(settings); break;
+    case Level::VERY_SLOW:  GetProfile_bc6h_veryslow(settings); break;
+    default:
+        break;
+    }
+}
+
+void initBC7Profile(bc7_enc_settings* settings, Level::Type level, bool forceRgbSpecified) {
+    if (forceRgbSpecified) {
+        switch (level) {
+        case Level::ULTRA_FAST: GetProfile_ultrafast(settings); break;
+        case Level::VERY_FAST:  GetProfile_veryfast(settings); break;
+        case Level::FAST:       GetProfile_fast(settings); break;
+        case Level::BASIC:      GetProfile_basic(settings); break;
+        case Level::SLOW:       GetProfile_slow(settings); break;
+        case Level::VERY_SLOW:  GetProfile_slow(settings); break;
+        default:
+            break;
+        }
+    }
+    else {
+        switch (level) {
+        case Level::ULTRA_FAST: GetProfile_alpha_ultrafast(settings); break;
+        case Level::VERY_FAST:  GetProfile_alpha_veryfast(settings); break;
+        case Level::FAST:       GetProfile_alpha_fast(settings); break;
+        case Level::BASIC:      GetProfile_alpha_basic(settings); break;
+        case Level::SLOW:       GetProfile_alpha_slow(settings); break;
+        case Level::VERY_SLOW:  GetProfile_alpha_slow(settings); break;
+        default:
+            break;
+        }
+    }
+}
+
+// --dedupのブロックキャッシュの最大エントリ数。1エントリは約200バイトで、最大100MB程度になる。
+const size_t kBlockCacheCapacity = (size_t)1 << 19;
+
+// プロセス全体で共有するブロックキャッシュ。スレッドと--batchのファイルをまたいで使う。
+util::BlockCache& getBlockCache() {
+    static util::BlockCache cache(kBlockCacheCapacity);
+    return cache;
+}
+
+// --refineで最初に全ブロックを圧縮する品質。これより速い品質が指定された場合、--refineは無視する。
+const Level::Type kRefineFirstLevel = Level::VERY_FAST;
+
+// blockCacheは--dedupの場合のみ設定する。
+// fingerprintは圧縮結果に影響する設定の識別子で、ブロックキャッシュのキーの先頭に置く。
+// refineは--refineの場合のみ設定する。まずfastBc6h,fastBc7で圧縮し、誤差の大きいブロックだけを
+// bc6h,bc7で圧縮し直す。refineErrorは圧縮し直すブロックの二乗誤差の和の下限(0は制限なし)、
+// refineRatioは誤差の大きい順に圧縮し直すブロックの割合(0は制限なし)で、サブリソース全体の誤差から選ぶ
+// (refineSubresources)。この場合、blockCacheは設定しない。
+struct EncoderSettings {
+    DXGI_FORMAT format;
+    bc6h_enc_settings bc6h;
+    bc7_enc_settings bc7;
+    util::BlockCache* blockCache;
+    uint64_t fingerprint;
+    bool refine;
+    bc6h_enc_settings fastBc6h;
+    bc7_enc_settings fastBc7;
+    float refineError;
+    float refineRatio;
+};
+
+// --refine <psnr>のPSNRを、1ブロックの二乗誤差の和に換算する。
+// BC7は8ビットの値、BC6Hはhalf floatのビット列(最大の有限値0x7BFF)に対するPSNRとして扱う。
+float getRefineError(DXGI_FORMAT format, int channels, float psnr) {
+    double peak = format == DXGI_FORMAT_BC6H_UF16 ? 0x7BFF : 255;
+    return (float)(peak * peak / std::pow(10.0, psnr / 10.0) * 16 * channels);
+}
+
+EncoderSettings initEncoderSettings(const Spec& spec) {
+    EncoderSettings settings = {};
+    settings.format = spec.format;
+    bool profiled = false;
+    if (spec.format == DXGI_FORMAT_BC6H_UF16) {
+        initBC6HProfile(&settings.bc6h, spec.level);
+        profiled = true;
+    }
+    if (spec.format == DXGI_FORMAT_BC7_UNORM) {
+        initBC7Profile(&settings.bc7, spec.level, spec.forceRgbSpecified);
+        profiled = true;
+    }
+    if (profiled && (spec.refinePsnr > 0 || spec.refinePercent > 0) && spec.level > kRefineFirstLevel) {
+        settings.refine = true;
+        initBC6HProfile(&settings.fastBc6h, kRefineFirstLevel);
+        initBC7Profile(&settings.fastBc7, kRefineFirstLevel, spec.forceRgbSpecified);
+        int channels = spec.format == DXGI_FORMAT_BC7_UNORM ? settings.bc7.channels : 3;
+        settings.refineError = spec.refinePsnr > 0 ? getRefineError(spec.format, channels, spec.refinePsnr) : 0.0f;
+        settings.refineRatio = std::min(spec.refinePercent, 100.0f) / 100;
+    }
+    // 割合で選ぶブロックはサブリソース全体の誤差で決まり、ブロック単位の結果を使い回せないので--dedupは無視する。
+    if (spec.dedupSpecified && settings.refineRatio == 0) {
+        // 品質と--forceRgbと--refineはBC6H,BC7でのみ圧縮結果に影響する。
+        int32_t values[] = {
+            (int32_t)ISPC_TEXCOMP_VERSION,
+            (int32_t)spec.format,
+            profiled ? (int32_t)spec.level : 0,
+            profiled && spec.forceRgbSpecified ? 1 : 0,
+            settings.refine ? (int32_t)std::lround(spec.refinePsnr * 1000) : 0,
+        };
+        settings.blockCache = &getBlockCache();
+        settings.fingerprint = util::hash64(values, sizeof(values));
+    }
+    return settings;
+}
+
+// --verboseで表示するBC6H,BC7のエンコーダーの統計。
+// dedupBlocksは--dedupで調べたブロック数、dedupHitsはそのうち圧縮せずにコピーしたブロック数。
+// refineBlocksは--refineで最初に圧縮したブロック数、refinedはそのうち圧縮し直したブロック数、
+// refineImprovedはさらにそのうち誤差が減って結果を置き換えたブロック数。
+struct EncoderStats {
+    bc6h_enc_stats bc6h;
+    bc7_enc_stats bc7;
+    uint64_t dedupBlocks;
+    uint64_t dedupHits;
+    uint64_t refineBlocks;
+    uint64_t refined;
+    uint64_t refineImproved;
+};
+
+// ジョブ全体の統計。カーネルの統計はintで、候補数などは大きな画像ではintに収まらないので、
+// 同じ項目を64bitで持つ。
+struct BC7StatsTotal {
+    uint64_t blocks;
+    uint64_t solid;
+    uint64_t mode[8];
+    uint64_t partition[8][64];
+    uint64_t rotation[8][4];
+    uint64_t candidates[8];
+    uint64_t pruned[8];
+    uint64_t refine_iterations[8];
+    uint64_t refine_improved[8];
+};
+
+struct BC6HStatsTotal {
+    uint64_t blocks;
+    uint64_t solid;
+    uint64_t mode[14];
+    uint64_t partition[32];
+    uint64_t mode_passed[14];
+    uint64_t mode_skipped[14];
+    uint64_t candidates;
+    uint64_t pruned;
+    uint64_t refine_iterations[2];
+    uint64_t refine_improved[2];
+};
+
+struct EncoderStatsSum {
+    BC6HStatsTotal bc6h;
+    BC7StatsTotal bc7;
+    uint64_t dedupBlocks;
+    uint64_t dedupHits;
+    uint64_t refineBlocks;
+    uint64_t refined;
+    uint64_t refineImproved;
+};
+
+template <size_t N>
+void addCounts(uint64_t (&dst)[N], const int (&src)[N]) {
+    for (size_t i = 0; i < N; ++i)
+        dst[i] += (uint64_t)src[i];
+}
+
+template <size_t N, size_t M>
+void addCounts(uint64_t (&dst)[N][M], const int (&src)[N][M]) {
+    for (size_t i = 0; i < N; ++i)
+        addCounts(dst[i], src[i]);
+}
+
+void addStats(BC7StatsTotal& dst, const bc7_enc_stats& src) {
+    dst.blocks += (uint64_t)src.blocks;
+    dst.solid += (uint64_t)src.solid;
+    addCounts(dst.mode, src.mode);
+    addCounts(dst.partition, src.partition);
+    addCounts(dst.rotation, src.rotation);
+    addCounts(dst.candidates, src.candidates);
+    addCounts(dst.pruned, src.pruned);
+    addCounts(dst.refine_iterations, src.refine_iterations);
+    addCounts(dst.refine_improved, src.refine_improved);
+}
+
+void addStats(BC6HStatsTotal& dst, const bc6h_enc_stats& src) {
+    dst.blocks += (uint64_t)src.blocks;
+    dst.solid += (uint64_t)src.solid;
+    addCounts(dst.mode, src.mode);
+    addCounts(dst.partition, src.partition);
+    addCounts(dst.mode_passed, src.mode_passed);
+    addCounts(dst.mode_skipped, src.mode_skipped);
+    dst.candidates += (uint64_t)src.candidates;
+    dst.pruned += (uint64_t)src.pruned;
+    addCounts(dst.refine_iterations, src.refine_iterations);
+    addCounts(dst.refine_improved, src.refine_improved);
+}
+
+// タスクごとに集計した統計を合計する。タスクの統計は1バンド分なのでintに収まる。
+class EncoderStatsTotal {
+public:
+    void add(const EncoderStats& stats) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        addStats(mStats.bc6h, stats.bc6h);
+        addStats(mStats.bc7, stats.bc7);
+        mStats.dedupBlocks += stats.dedupBlocks;
+        mStats.dedupHits += stats.dedupHits;
+        mStats.refineBlocks += stats.refineBlocks;
+        mStats.refined += stats.refined;
+        mStats.refineImproved += stats.refineImproved;
+    }
+
+    const EncoderStatsSum& get() const { return mStats; }
+
+private:
+    std::mutex mMutex;
+    EncoderStatsSum mStats = {};
+};
+
+size_t getBlockBytes(DXGI_FORMAT format);
+int32_t getSourceBitsPerPixel(DXGI_FORMAT format);
+void compressBlocksWithErrors(const rgba_surface* surface, uint8_t* dst, DXGI_FORMAT format, bc6h_enc_settings bc6h,
+                              bc7_enc_settings bc7, EncoderStats* stats, float* errors);
+void compressBlocksRefined(const rgba_surface* surface, uint8_t* dst, const EncoderSettings& settings, EncoderStats* stats);
+
+// カーネルは設定を書き換えないが、引数が非constなのでバンドごとにコピーを渡す。
+// statsがnullptrでない場合は、統計を集計する版のカーネルで圧縮する。
+// errorsは--refineで割合を指定した場合の1回目の圧縮で設定し、速い設定で圧縮してブロックごとの誤差を書き込む。
+void compressBlocks(const rgba_surface* surface, uint8_t* dst, EncoderSettings settings, EncoderStats* stats, float* errors = nullptr) {
+    if (settings.refine) {
+        if (errors)
+            compressBlocksWithErrors(surface, dst, settings.format, settings.fastBc6h, settings.fastBc7, stats, errors);
+        else
+            compressBlocksRefined(surface, dst, settings, stats);
+        return;
+    }
+    switch (settings.format) {
+      case DXGI_FORMAT_BC1_UNORM: {
+        CompressBlocksBC1(surface, dst);
+        break;
+      }
+      case DXGI_FORMAT_BC3_UNORM: {
+        CompressBlocksBC3(surface, dst);
+        break;
+      }
+      case DXGI_FORMAT_BC4_UNORM: {
+        CompressBlocksBC4(surface, dst);
+        break;
+      }
+      case DXGI_FORMAT_BC5_UNORM: {
+        CompressBlocksBC5(surface, dst);
+        break;
+      }
+      case DXGI_FORMAT_BC6H_UF16: {
+        if (stats)
+            CompressBlocksBC6HStats(surface, dst, &settings.bc6h, &stats->bc6h);
+        else
+            CompressBlocksBC6H(surface, dst, &settings.bc6h);
+        break;
+      }
+      case DXGI_FORMAT_BC7_UNORM: {
+        if (stats)
+            CompressBlocksBC7Stats(surface, dst, &settings.bc7, &stats->bc7);
+        else
+            CompressBlocksBC7(surface, dst, &settings.bc7);
+        break;
+      }
+      default:
+        break;
+    }
+}
+
+size_t getBlockBytes(DXGI_FORMAT format) {
+    return format == DXGI_FORMAT_BC1_UNORM || format == DXGI_FORMAT_BC4_UNORM ? 8 : 16;
+}
+
+// 圧縮前のピクセルのビット数。BC6Hはhalf floatのRGBA、それ以外はRGBA8。
+int32_t getSourceBitsPerPixel(DXGI_FORMAT format) {
+    return format == DXGI_FORMAT_BC6H_UF16 ? 64 : 32;
+}
+
+// サーフェスの(bx, by)の4x4ブロックを、行の間隔dstStrideでdstに書き出す。
+// 右端と下端の欠けた部分はReplicateBordersと同じく端のピクセルを複製する。
+void copyBlock(const rgba_surface& surface, size_t bx, size_t by, size_t pixelBytes, uint8_t* dst, size_t dstStride) {
+    for (size_t y = 0; y < 4; ++y) {
+        size_t yy = std::min(by * 4 + y, (size_t)surface.height - 1);
+        const uint8_t* line = surface.ptr + yy * surface.stride;
+        uint8_t* out = dst + y * dstStride;
+        if (bx * 4 + 4 <= (size_t)surface.width) {
+            memcpy(out, line + bx * 4 * pixelBytes, 4 * pixelBytes);
+            continue;
+        }
+        for (size_t x = 0; x < 4; ++x) {
+            size_t xx = std::min(bx * 4 + x, (size_t)surface.width - 1);
+            memcpy(out + x * pixelBytes, line + xx * pixelBytes, pixelBytes);
+        }
+    }
+}
+
+// BC6H,BC7のブロックを圧縮し、ブロックごとの二乗誤差の和をerrorsに書き込む。
+void compressBlocksWithErrors(const rgba_surface* surface, uint8_t* dst, DXGI_FORMAT format, bc6h_enc_settings bc6h,
+                              bc7_enc_settings bc7, EncoderStats* stats, float* errors) {
+    if (format == DXGI_FORMAT_BC6H_UF16)
+        CompressBlocksBC6HErrors(surface, dst, &bc6h, stats ? &stats->bc6h : nullptr, errors);
+    else
+        CompressBlocksBC7Errors(surface, dst, &bc7, stats ? &stats->bc7 : nullptr, errors);
+}
+
+// --refineで使う作業領域。スレッドごとに使い回す。
+struct RefineBuffers {
+    std::vector<float> errors;
+    std::vector<float> refinedErrors;
+    std::vector<uint32_t> blocks;       // 圧縮し直すブロックの番号
+    std::vector<uint8_t> staging;       // 圧縮し直すブロックを横に並べたサーフェス
+    std::vector<uint8_t> encoded;
+};
+
+thread_local RefineBuffers tlsRefineBuffers;
+
+// surfaceのblocksのブロック(ラスター順の番号)を横に並べて指定の品質で圧縮し直し、誤差がerrorsより
+// 減ったものだけを行の間隔dstRowPitchのdstに書き込む。端の欠けたブロックは端のピクセルを複製する。
+// 置き換えたブロック数を返す。
+uint64_t recompressBlocks(const rgba_surface& surface, uint8_t* dst, size_t dstRowPitch, const uint32_t* blocks, size_t count,
+                          const float* errors, const EncoderSettings& settings, EncoderStats* stats) {
+    size_t pixelBytes = (size_t)getSourceBitsPerPixel(settings.format) / 8;
+    size_t blockBytes = getBlockBytes(settings.format);
+    size_t blocksX = ((size_t)surface.width + 3) / 4;
+
+    auto& buffers = tlsRefineBuffers;
+    size_t rowBytes = count * 4 * pixelBytes;
+    buffers.staging.resize(rowBytes * 4);
+    buffers.encoded.resize(count * blockBytes);
+    buffers.refinedErrors.resize(count);
+    for (size_t i = 0; i < count; ++i)
+        copyBlock(surface, blocks[i] % blocksX, blocks[i] / blocksX, pixelBytes, &buffers.staging[i * 4 * pixelBytes], rowBytes);
+
+    rgba_surface staging;
+    staging.ptr = buffers.staging.data();
+    staging.width = (int32_t)(count * 4);
+    staging.height = 4;
+    staging.stride = (int32_t)rowBytes;
+    compressBlocksWithErrors(&staging, buffers.encoded.data(), settings.format, settings.bc6h, settings.bc7, stats,
+                             buffers.refinedErrors.data());
+
+    uint64_t improved = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (buffers.refinedErrors[i] < errors[blocks[i]]) {
+            size_t bx = blocks[i] % blocksX, by = blocks[i] / blocksX;
+            memcpy(dst + by * dstRowPitch + bx * blockBytes, &buffers.encoded[i * blockBytes], blockBytes);
+            ++improved;
+        }
+    }
+    return improved;
+}
+
+// --refineでPSNRだけを指定した場合。全ブロックを速い設定で圧縮してから、誤差がrefineErrorを超えるブロックだけを
+// 指定の品質で圧縮し直す。ブロックごとに決まるので、分割や--dedupによらず出力は同一になる。
+void compressBlocksRefined(const rgba_surface* surface, uint8_t* dst, const EncoderSettings& settings, EncoderStats* stats) {
+    size_t blockBytes = getBlockBytes(settings.format);
+    size_t blocksX = (size_t)surface->width / 4;
+    size_t count = blocksX * (size_t)(surface->height / 4);
+    if (count == 0) return;
+
+    auto& buffers = tlsRefineBuffers;
+    buffers.errors.resize(count);
+    compressBlocksWithErrors(surface, dst, settings.format, settings.fastBc6h, settings.fastBc7, stats, buffers.errors.data());
+
+    auto& blocks = buffers.blocks;
+    blocks.clear();
+    for (uint32_t i = 0; i < count; ++i) {
+        if (buffers.errors[i] > settings.refineError)
+            blocks.push_back(i);
+    }
+    if (stats) {
+        stats->refineBlocks += count;
+        stats->refined += blocks.size();
+    }
+    if (blocks.empty()) return;
+
+    uint64_t improved = recompressBlocks(*surface, dst, blocksX * blockBytes, blocks.data(), blocks.size(), buffers.errors.data(),
+                                         settings, stats);
+    if (stats)
+        stats->refineImproved += improved;
+}
+
+// --refineで割合を指定した場合に、サブリソース全体の誤差から圧縮し直すブロックを選ぶ。
+// 誤差が同じ場合は番号の小さい方を選ぶので、分割や実行順によらず同じブロックになる。
+void selectRefineBlocks(const std::vector<float>& errors, const EncoderSettings& settings, std::vector<uint32_t>& blocks) {
+    blocks.clear();
+    for (uint32_t i = 0; i < errors.size(); ++i) {
+        if (errors[i] > settings.refineError)
+            blocks.push_back(i);
+    }
+    size_t limit = (size_t)std::lround(errors.size() * settings.refineRatio);
+    if (blocks.size() > limit) {
+        std::nth_element(blocks.begin(), blocks.begin() + limit, blocks.end(), [&errors](uint32_t a, uint32_t b) {
+            return errors[a] != errors[b] ? errors[a] > errors[b] : a < b;
+        });
+        blocks.resize(limit);
+        std::sort(blocks.begin(), blocks.end());
+    }
+}
+
+// 圧縮の最小単位。1つのサブリソースを4x4ブロック行単位で横長に分割したもの。
+// surfaceはサブリソース全体を指し、幅・高さは4の倍数とは限らない。
+// subresourceはTexMetadata::ComputeIndexで求めたサブリソースの番号。
+// errorsは--refineで割合を指定した場合のみ設定し、サブリソース全体のブロックごとの誤差を書き込む。
+struct CompressTask {
+    rgba_surface surface;
+    size_t firstRow;
+    size_t numRows;
+    uint8_t* dst;
+    size_t dstRowPitch;
+    size_t subresource;
+    float* errors;
+};
+
+// サーフェスをバンドに分割してタスクリストに追加する。
+// ブロックは互いに独立して圧縮されるため、分割数によらず出力は同一になる。
+void appendBands(std::vector<CompressTask>& tasks, const rgba_surface& surface, uint8_t* dst, size_t dstRowPitch, size_t subresource,
+                 float* errors = nullptr) {
+    size_t blockRows = ((size_t)surface.height + 3) / 4;
+    size_t bandRows = std::max(kBandBytes / ((size_t)surface.stride * 4), (size_t)1);
+    for (size_t firstRow = 0; firstRow < blockRows; firstRow += bandRows) {
+        CompressTask task;
+        task.surface = surface;
+        task.firstRow = firstRow;
+        task.numRows = std::min(bandRows, blockRows - firstRow);
+        task.dst = dst;
+        task.dstRowPitch = dstRowPitch;
+        task.subresource = subresource;
+        task.errors = errors;
+        tasks.push_back(task);
+    }
+}
+
+// 端のブロックを組み立てるための作業領域。スレッドごとに使い回す。
+thread_local std::vector<uint8_t> tlsBorderBuffer;
+
+// --dedupで1ブロック行を処理するための作業領域。スレッドごとに使い回す。
+struct DedupBuffers {
+    std::vector<uint8_t> keys;          // ブロックごとのキャッシュのキー
+    std::vector<uint64_t> hashes;       // キーのハッシュ値
+    std::vector<int32_t> sources;       // 圧縮したブロックの番号。キャッシュにあった場合は-1
+    std::vector<int32_t> firsts;        // 圧縮するブロックごとの、行内で最初に現れた位置
+    std::vector<int32_t> table;         // 行内の重複を見つけるためのハッシュ表
+    std::vector<uint8_t> staging;       // 圧縮するブロックを横に並べたサーフェス
+    std::vector<uint8_t> encoded;
+};
+
+thread_local DedupBuffers tlsDedupBuffers;
+
+// ブロックをキャッシュから探し、見つからなかったブロックだけを横に並べて圧縮する。
+// 同じ行で重複するブロックは1回だけ圧縮する。端の欠けたブロックはReplicateBordersと同じく
+// 端のピクセルを複製してから扱うので、出力はcompressBandと同一になる。
+// --refineで割合を指定した場合は使わないので、task.errorsは扱わない。
+void compressBandDeduplicated(const CompressTask& task, const EncoderSettings& settings, EncoderStats* stats) {
+    auto& surface = task.surface;
+    size_t pixelBytes = (size_t)getSourceBitsPerPixel(settings.format) / 8;
+    size_t blockBytes = getBlockBytes(settings.format);
+    size_t keySize = sizeof(settings.fingerprint) + pixelBytes * 16;
+    size_t blocksX = ((size_t)surface.width + 3) / 4;
+    size_t tableSize = 1;
+    while (tableSize < blocksX * 2)
+        tableSize *= 2;
+
+    auto& buffers = tlsDedupBuffers;
+    buffers.keys.resize(blocksX * keySize);
+    buffers.hashes.resize(blocksX);
+    buffers.sources.resize(blocksX);
+    buffers.firsts.resize(blocksX);
+    buffers.table.resize(tableSize);
+    buffers.staging.resize(blocksX * 16 * pixelBytes);
+    buffers.encoded.resize(blocksX * blockBytes);
+
+    for (size_t row = task.firstRow; row < task.firstRow + task.numRows; ++row) {
+        uint8_t* dst = task.dst + row * task.dstRowPitch;
+        std::fill(buffers.table.begin(), buffers.table.end(), -1);
+        int32_t count = 0;
+
+        for (size_t bx = 0; bx < blocksX; ++bx) {
+            uint8_t* key = &buffers.keys[bx * keySize];
+            memcpy(key, &settings.fingerprint, sizeof(settings.fingerprint));
+            uint8_t* pixels = key + sizeof(settings.fingerprint);
+            copyBlock(surface, bx, row, pixelBytes, pixels, 4 * pixelBytes);
+            uint64_t hash = util::hash64(key, keySize);
+            buffers.hashes[bx] = hash;
+
+            if (settings.blockCache->find(hash, key, keySize, dst + bx * blockBytes, blockBytes)) {
+                buffers.sources[bx] = -1;
+                continue;
+            }
+
+            // 同じ行で既に圧縮することにしたブロックと同じなら、その結果を使う。
+            size_t slot = (size_t)hash & (tableSize - 1);
+            for (; buffers.table[slot] >= 0; slot = (slot + 1) & (tableSize - 1)) {
+                int32_t first = buffers.firsts[buffers.table[slot]];
+                if (buffers.hashes[first] == hash && memcmp(&buffers.keys[(size_t)first * keySize], key, keySize) == 0)
+                    break;
+            }
+            if (buffers.table[slot] < 0) {
+                buffers.table[slot] = count;
+                buffers.firsts[count] = (int32_t)bx;
+                for (size_t y = 0; y < 4; ++y)
+                    memcpy(&buffers.staging[(y * blocksX * 4 + (size_t)count * 4) * pixelBytes], pixels + y * 4 * pixelBytes, 4 * pixelBytes);
+                ++count;
+            }
+            buffers.sources[bx] = buffers.table[slot];
+        }
+
+        if (stats) {
+            stats->dedupBlocks += blocksX;
+            stats->dedupHits += blocksX - count;
+        }
+        if (count == 0)
+            continue;
+
+        // 作業領域の行の間隔は行の全ブロックが収まる幅で固定し、圧縮するブロック数だけの幅を渡す。
+        rgba_surface staging;
+        staging.ptr = buffers.staging.data();
+        staging.width = count * 4;
+        staging.height = 4;
+        staging.stride = (int32_t)(blocksX * 4 * pixelBytes);
+        compressBlocks(&staging, buffers.encoded.data(), settings, stats);
+
+        for (size_t bx = 0; bx < blocksX; ++bx) {
+            if (buffers.sources[bx] >= 0)
+                memcpy(dst + bx * blockBytes, &buffers.encoded[(size_t)buffers.sources[bx] * blockBytes], blockBytes);
+        }
+        for (int32_t i = 0; i < count; ++i) {
+            size_t bx = (size_t)buffers.firsts[i];
+            settings.blockCache->insert(buffers.hashes[bx], &buffers.keys[bx * keySize], keySize,
+                                        &buffers.encoded[(size_t)i * blockBytes], blockBytes);
+        }
+    }
+}
+
+// 内側のブロックはサーフェスから直接圧縮し、右端と下端の欠けたブロックだけを
+// ReplicateBordersで作業領域に複製してから圧縮する。
+void compressBand(const CompressTask& task, const EncoderSettings& settings, EncoderStats* stats) {
+    if (settings.blockCache) {
+        compressBandDeduplicated(task, settings, stats);
+        return;
+    }
+
+    auto& surface = task.surface;
+    int32_t bpp = getSourceBitsPerPixel(settings.format);
+    size_t blockBytes = getBlockBytes(settings.format);
+    int32_t innerWidth = surface.width & ~3;
+    size_t innerRows = (size_t)surface.height / 4;
+    size_t endRow = task.firstRow + task.numRows;
+    size_t blocksX = ((size_t)surface.width + 3) / 4;
+    auto errorsAt = [&](size_t row, size_t bx) { return task.errors ? task.errors + row * blocksX + bx : nullptr; };
+
+    // カーネルは出力の行ピッチを入力の幅から求めるので、右端が欠けている場合は1行ずつ処理する。
+    size_t firstInner = task.firstRow, endInner = std::min(endRow, innerRows);
+    if (innerWidth > 0) {
+        size_t step = innerWidth == surface.width ? endInner - firstInner : 1;
+        for (size_t row = firstInner; row < endInner; row += step) {
+            rgba_surface inner;
+            inner.ptr = surface.ptr + row * 4 * surface.stride;
+            inner.width = innerWidth;
+            inner.height = (int32_t)(step * 4);
+            inner.stride = surface.stride;
+            compressBlocks(&inner, task.dst + row * task.dstRowPitch, settings, stats, errorsAt(row, 0));
+        }
+    }
+
+    if (innerWidth == surface.width && endRow <= innerRows)
+        return;
+
+    int32_t paddedWidth = (surface.width + 3) & ~3;
+    int32_t stride = paddedWidth * (bpp >> 3);
+    auto& buffer = tlsBorderBuffer;
+    if (buffer.size() < (size_t)stride * 4)
+        buffer.resize((size_t)stride * 4);
+
+    rgba_surface border;
+    border.ptr = buffer.data();
+    border.height = 4;
+
+    if (innerWidth < surface.width) {
+        border.width = 4;
+        border.stride = 4 * (bpp >> 3);
+        for (size_t row = firstInner; row < endInner; ++row) {
+            ReplicateBorders(&border, &surface, innerWidth, (int)(row * 4), bpp);
+            compressBlocks(&border, task.dst + row * task.dstRowPitch + innerWidth / 4 * blockBytes, settings, stats,
+                           errorsAt(row, innerWidth / 4));
+        }
+    }
+
+    // 下端の欠けたブロック行は右下の角も含めて1行まとめて複製する。
+    if (endRow > innerRows) {
+        border.width = paddedWidth;
+        border.stride = stride;
+        ReplicateBorders(&border, &surface, 0, (int)(innerRows * 4), bpp);
+        compressBlocks(&border, task.dst + innerRows * task.dstRowPitch, settings, stats, errorsAt(innerRows, 0));
+    }
+}
+
+// トレースに記録するタスクの引数。
+std::string getTaskArgs(const CompressTask& task) {
+    char args[128];
+    snprintf(args, sizeof(args), "\"subresource\":%zu,\"width\":%d,\"firstRow\":%zu,\"rows\":%zu",
+             task.subresource, task.surface.width, task.firstRow, task.numRows);
+    return args;
+}
+
+// --verboseで表示するサブリソースごとの圧縮時間。
+// 各タスクの開始と終了の時刻から、そのサブリソースの最初の開始から最後の終了までを求める。
+class SubresourceTimes {
+public:
+    explicit SubresourceTimes(size_t count) : mBegin(count, INT64_MAX), mEnd(count, 0) { }
+
+    void add(size_t subresource, int64_t begin, int64_t end) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mBegin[subresource] = std::min(mBegin[subresource], begin);
+        mEnd[subresource] = std::max(mEnd[subresource], end);
+    }
+
+    double getSeconds(size_t subresource) const {
+        return mEnd[subresource] > mBegin[subresource] ? (mEnd[subresource] - mBegin[subresource]) / 1e6 : 0.0;
+    }
+
+private:
+    std::mutex mMutex;
+    std::vector<int64_t> mBegin;
+    std::vector<int64_t> mEnd;
+};
+
+// timesとtotalStatsはnullptrでもよい。
+void runCompressTask(const CompressTask& task, const EncoderSettings& settings, SubresourceTimes* times, EncoderStatsTotal* totalStats) {
+    auto& tracer = util::Tracer::get();
+    EncoderStats stats = {};
+    EncoderStats* taskStats = totalStats ? &stats : nullptr;
+    if (!times && !tracer.isEnabled()) {
+        compressBand(task, settings, taskStats);
+    }
+    else {
+        int64_t begin = tracer.now();
+        compressBand(task, settings, taskStats);
+        int64_t end = tracer.now();
+        if (times)
+            times->add(task.subresource, begin, end);
+        if (tracer.isEnabled())
+            tracer.record("compress", "task", begin, end, getTaskArgs(task));
+    }
+    if (totalStats)
+        totalStats->add(stats);
+}
+
+// これ以下のブロック数のサブリソースは、ブロック行ごとに圧縮するとSIMDのレーンが余るので、
+// 複数をまとめて圧縮する。32x32ピクセルに相当する。
+const size_t kSmallSurfaceBlocks = 64;
+
+// まとめて圧縮する1回あたりのブロック数の上限。
+const size_t kBatchBlocks = 256;
+
+// まとめて圧縮する小さいサブリソース。errorsはCompressTaskと同じ。
+struct SmallSurface {
+    rgba_surface surface;
+    uint8_t* dst;
+    size_t dstRowPitch;
+    size_t subresource;
+    float* errors;
+};
+
+// 小さいサブリソースのブロックを横1列に並べ、1つのタスクで圧縮する単位。
+struct CompressBatch {
+    std::vector<SmallSurface> surfaces;
+    size_t blocks = 0;
+};
+
+size_t countBlocks(const rgba_surface& surface) {
+    return (((size_t)surface.width + 3) / 4) * (((size_t)surface.height + 3) / 4);
+}
+
+bool isSmallSurface(const rgba_surface& surface) {
+    return countBlocks(surface) <= kSmallSurfaceBlocks;
+}
+
+// 小さいサブリソースを、ブロック数の合計がkBatchBlocksを超えないように順にまとめる。
+void appendBatches(std::vector<CompressBatch>& batches, const std::vector<SmallSurface>& surfaces) {
+    for (auto& small : surfaces) {
+        size_t blocks = countBlocks(small.surface);
+        if (blocks == 0) continue;
+        if (batches.empty() || batches.back().blocks + blocks > kBatchBlocks)
+            batches.emplace_back();
+        batches.back().surfaces.push_back(small);
+        batches.back().blocks += blocks;
+    }
+}
+
+// まとめて圧縮するための作業領域。スレッドごとに使い回す。
+struct BatchBuffers {
+    std::vector<uint8_t> staging;       // 全ブロックを横に並べたサーフェス
+    std::vector<uint8_t> encoded;
+    std::vector<float> errors;
+};
+
+thread_local BatchBuffers tlsBatchBuffers;
+
+// 作業領域に横1列に並べたblocks個のブロックを圧縮し、encodedに順に書き込む。strideは作業領域の行の間隔。
+// --dedupの場合もcompressBandに任せる。作業領域の幅は4の倍数なので端の処理は起きない。
+void compressStagedBlocks(uint8_t* staging, size_t stride, size_t blocks, uint8_t* encoded, float* errors, size_t subresource,
+                          const EncoderSettings& settings, EncoderStats* stats) {
+    CompressTask task;
+    task.surface.ptr = staging;
+    task.surface.width = (int32_t)(blocks * 4);
+    task.surface.height = 4;
+    task.surface.stride = (int32_t)stride;
+    task.firstRow = 0;
+    task.numRows = 1;
+    task.dst = encoded;
+    task.dstRowPitch = blocks * getBlockBytes(settings.format);
+    task.subresource = subresource;
+    task.errors = errors;
+    compressBand(task, settings, stats);
+}
+
+// 全ブロックを作業領域に集めて1ブロック行として圧縮し、それぞれのサブリソースの出力に書き戻す。
+// ブロックは互いに独立して圧縮されるため、出力はサブリソースごとに圧縮した場合と同一になる。
+void compressBatch(const CompressBatch& batch, const EncoderSettings& settings, EncoderStats* stats) {
+    size_t pixelBytes = (size_t)getSourceBitsPerPixel(settings.format) / 8;
+    size_t blockBytes = getBlockBytes(settings.format);
+    size_t rowBytes = batch.blocks * 4 * pixelBytes;
+    auto& buffers = tlsBatchBuffers;
+    buffers.staging.resize(rowBytes * 4);
+    buffers.encoded.resize(batch.blocks * blockBytes);
+    bool hasErrors = batch.surfaces.front().errors != nullptr;
+    if (hasErrors)
+        buffers.errors.resize(batch.blocks);
+
+    size_t i = 0;
+    for (auto& small : batch.surfaces) {
+        size_t blocksX = ((size_t)small.surface.width + 3) / 4, blocksY = ((size_t)small.surface.height + 3) / 4;
+        for (size_t by = 0; by < blocksY; ++by) {
+            for (size_t bx = 0; bx < blocksX; ++bx, ++i)
+                copyBlock(small.surface, bx, by, pixelBytes, &buffers.staging[i * 4 * pixelBytes], rowBytes);
+        }
+    }
+
+    compressStagedBlocks(buffers.staging.data(), rowBytes, batch.blocks, buffers.encoded.data(),
+                         hasErrors ? buffers.errors.data() : nullptr, batch.surfaces.front().subresource, settings, stats);
+
+    i = 0;
+    for (auto& small : batch.surfaces) {
+        size_t blocksX = ((size_t)small.surface.width + 3) / 4, blocksY = ((size_t)small.surface.height + 3) / 4;
+        for (size_t by = 0; by < blocksY; ++by) {
+            uint8_t* dst = small.dst + by * small.dstRowPitch;
+            memcpy(dst, &buffers.encoded[i * blockBytes], blocksX * blockBytes);
+            if (hasErrors)
+                std::copy_n(&buffers.errors[i], blocksX, small.errors + by * blocksX);
+            i += blocksX;
+        }
+    }
+}
+
+// runCompressTaskと同じく、timesとtotalStatsはnullptrでもよい。時間は含まれる全サブリソースに記録する。
+void runCompressBatch(const CompressBatch& batch, const EncoderSettings& settings, SubresourceTimes* times, EncoderStatsTotal* totalStats) {
+    auto& tracer = util::Tracer::get();
+    EncoderStats stats = {};
+    EncoderStats* batchStats = totalStats ? &stats : nullptr;
+    int64_t begin = times || tracer.isEnabled() ? tracer.now() : 0;
+    compressBatch(batch, settings, batchStats);
+    if (times || tracer.isEnabled()) {
+        int64_t end = tracer.now();
+        if (times) {
+            for (auto& small : batch.surfaces)
+                times->add(small.subresource, begin, end);
+        }
+        if (tracer.isEnabled()) {
+            char args[64];
+            snprintf(args, sizeof(args), "\"subresources\":%zu,\"blocks\":%zu", batch.surfaces.size(), batch.blocks);
+            tracer.record("compress batch", "task", begin, end, args);
+        }
+    }
+    if (totalStats)
+        totalStats->add(stats);
+}
+
+// initEncoderSettingsが参照する設定が同じで、同じ設定で圧縮できるかどうか。
+bool hasSameEncoderSettings(const Spec& a, const Spec& b) {
+    return a.format == b.format && a.level == b.level && a.forceRgbSpecified == b.forceRgbSpecified &&
+           a.refinePsnr == b.refinePsnr && a.refinePercent == b.refinePercent && a.dedupSpecified == b.dedupSpecified;
+}
+
+// --batchで、小さいサブリソースをファイルをまたいでまとめて圧縮する。
+// 小さいファイルはミップマップを含めてもkBatchBlocksに満たないので、ファイルごとにまとめると
+// 1回の圧縮のブロック数が少なく、タスクの数も多くなる。
+// add()はブロックを作業領域に複製するので、戻った後は入力の画像を解放してよい。
+// 出力への書き込みは、そのジョブのwait()が戻るまで完了しない。
+// add()は圧縮の段階、wait()は保存の段階から呼び出す。保存はジョブの順に行われるので、
+// 開いているまとまりはそこに含まれる最初のジョブの保存で投入される。
+class SharedBatcher {
+public:
+    explicit SharedBatcher(util::ThreadPool& pool) : mPool(pool) { }
+
+    SharedBatcher(SharedBatcher const&) = delete;
+    SharedBatcher& operator=(SharedBatcher const&) = delete;
+
+    // jobの小さいサブリソースを開いているまとまりに追加する。ブロック数がkBatchBlocksを超える場合と、
+    // 圧縮の設定が異なる場合は、開いているまとまりを投入してから新しくまとめる。
+    void add(const Job& job, const EncoderSettings& settings, const std::vector<SmallSurface>& surfaces) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mOpen && !hasSameEncoderSettings(mOpen->spec, job.spec))
+            submit();
+        for (auto& small : surfaces) {
+            size_t blocks = countBlocks(small.surface);
+            if (blocks == 0) continue;
+            if (mOpen && mOpen->blocks + blocks > kBatchBlocks)
+                submit();
+            if (!mOpen)
+                open(job.spec, settings);
+            auto& batch = *mOpen;
+            if (batch.jobs.empty() || batch.jobs.back() != &job) {
+                batch.jobs.push_back(&job);
+                mBatches[&job].push_back(mOpen);
+            }
+
+            Target target;
+            target.dst = small.dst;
+            target.dstRowPitch = small.dstRowPitch;
+            target.blocksX = ((size_t)small.surface.width + 3) / 4;
+            target.blocksY = ((size_t)small.surface.height + 3) / 4;
+            for (size_t by = 0; by < target.blocksY; ++by) {
+                for (size_t bx = 0; bx < target.blocksX; ++bx, ++batch.blocks)
+                    copyBlock(small.surface, bx, by, batch.pixelBytes, &batch.staging[batch.blocks * 4 * batch.pixelBytes], batch.stride);
+            }
+            batch.targets.push_back(target);
+        }
+    }
+
+    // jobのブロックを含むまとまりの圧縮が終わるのを待つ。開いているまとまりに含まれる場合は先に投入する。
+    void wait(const Job& job) {
+        std::vector<std::shared_ptr<Batch>> batches;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto it = mBatches.find(&job);
+            if (it == mBatches.end())
+                return;
+            batches = std::move(it->second);
+            mBatches.erase(it);
+            if (mOpen && std::find(mOpen->jobs.begin(), mOpen->jobs.end(), &job) != mOpen->jobs.end())
+                submit();
+        }
+        for (auto& batch : batches)
+            mPool.wait(batch->group);
+    }
+
+private:
+    struct Target {
+        uint8_t* dst;
+        size_t dstRowPitch;
+        size_t blocksX;
+        size_t blocksY;
+    };
+
+    // ブロックは作業領域に左から詰める。作業領域の幅はkBatchBlocks個分。
+    struct Batch {
+        Spec spec;
+        EncoderSettings settings;
+        size_t pixelBytes;
+        size_t stride;
+        std::vector<uint8_t> staging;
+        size_t blocks = 0;
+        std::vector<Target> targets;
+        std::vector<const Job*> jobs;
+        util::TaskGroup group;
+    };
+
+    void open(const Spec& spec, const EncoderSettings& settings) {
+        mOpen = std::make_shared<Batch>();
+        mOpen->spec = spec;
+        mOpen->settings = settings;
+        mOpen->pixelBytes = (size_t)getSourceBitsPerPixel(settings.format) / 8;
+        mOpen->stride = kBatchBlocks * 4 * mOpen->pixelBytes;
+        mOpen->staging.resize(mOpen->stride * 4);
+    }
+
+    // 開いているまとまりを投入する。mMutexを取った状態で呼び出す。
+    // Batchは含まれるジョブのwait()が戻るまでmBatchesに残るので、タスクからは参照だけを持つ。
+    void submit() {
+        Batch* batch = mOpen.get();
+        mPool.submit(batch->group, [batch] { run(*batch); });
+        mOpen.reset();
+    }
+
+    static void run(Batch& batch) {
+        auto& tracer = util::Tracer::get();
+        int64_t begin = tracer.isEnabled() ? tracer.now() : 0;
+        size_t blockBytes = getBlockBytes(batch.settings.format);
+        auto& encoded = tlsBatchBuffers.encoded;
+        encoded.resize(batch.blocks * blockBytes);
+        compressStagedBlocks(batch.staging.data(), batch.stride, batch.blocks, encoded.data(), nullptr, 0, batch.settings, nullptr);
+
+        size_t i = 0;
+        for (auto& target : batch.targets) {
+            for (size_t by = 0; by < target.blocksY; ++by) {
+                memcpy(target.dst + by * target.dstRowPitch, &encoded[i * blockBytes], target.blocksX * blockBytes);
+                i += target.blocksX;
+            }
+        }
+        if (tracer.isEnabled()) {
+            char args[96];
+            snprintf(args, sizeof(args), "\"files\":%zu,\"subresources\":%zu,\"blocks\":%zu",
+                     batch.jobs.size(), batch.targets.size(), batch.blocks);
+            tracer.record("compress batch", "task", begin, tracer.now(), args);
+        }
+    }
+
+    util::ThreadPool& mPool;
+    std::mutex mMutex;
+    std::shared_ptr<Batch> mOpen;
+    std::unordered_map<const Job*, std::vector<std::shared_ptr<Batch>>> mBatches;
+};
+
+// --refineで割合を指定した場合の、1つのサブリソースの2回目の圧縮の対象。
+// errorsは1回目の圧縮で書き込むブロックごとの誤差で、端の欠けたブロックも含むラスター順。
+struct RefineTarget {
+    rgba_surface surface;
+    uint8_t* dst;
+    size_t dstRowPitch;
+    size_t subresource;
+    std::vector<float> errors;
+    std::vector<uint32_t> blocks;
+
+    float* init(const rgba_surface& s, uint8_t* d, size_t pitch, size_t index) {
+        surface = s;
+        dst = d;
+        dstRowPitch = pitch;
+        subresource = index;
+        errors.assign(countBlocks(s), 0.0f);
+        return errors.data();
+    }
+};
+
+// 2回目の圧縮の1タスクあたりのブロック数。
+const size_t kRefineTaskBlocks = 256;
+
+// 1回目の圧縮が終わったサブリソースごとに圧縮し直すブロックを選び、kRefineTaskBlocks個ずつpoolで圧縮する。
+// timesとtotalStatsはrunCompressTaskと同じ。
+void refineSubresources(util::ThreadPool& pool, const std::vector<RefineTarget*>& targets, const EncoderSettings& settings,
+                        SubresourceTimes* times, EncoderStatsTotal* totalStats) {
+    util::TaskGroup group;
+    for (auto target : targets) {
+        selectRefineBlocks(target->errors, settings, target->blocks);
+        if (totalStats) {
+            EncoderStats stats = {};
+            stats.refineBlocks = target->errors.size();
+            stats.refined = target->blocks.size();
+            totalStats->add(stats);
+        }
+        for (size_t first = 0; first < target->blocks.size(); first += kRefineTaskBlocks) {
+            size_t count = std::min(kRefineTaskBlocks, target->blocks.size() - first);
+            pool.submit(group, [&settings, target, first, count, times, totalStats] {
+                auto& tracer = util::Tracer::get();
+                int64_t begin = times || tracer.isEnabled() ? tracer.now() : 0;
+                EncoderStats stats = {};
+                stats.refineImproved = recompressBlocks(target->surface, target->dst, target->dstRowPitch, &target->blocks[first],
+                                                        count, target->errors.data(), settings, totalStats ? &stats : nullptr);
+                if (times || tracer.isEnabled()) {
+                    int64_t end = tracer.now();
+                    if (times)
+                        times->add(target->subresource, begin, end);
+                    if (tracer.isEnabled()) {
+                        char args[64];
+                        snprintf(args, sizeof(args), "\"subresource\":%zu,\"blocks\":%zu", target->subresource, count);
+                        tracer.record("refine", "task", begin, end, args);
+                    }
+                }
+                if (totalStats)
+                    totalStats->add(stats);
+            });
+        }
+    }
+    pool.wait(group);
+}
+
+size_t getDepth(const DirectX::TexMetadata& meta, size_t mip) {
+    if (meta.dimension != DirectX::TEX_DIMENSION_TEXTURE3D) return 1;
+    return std::max(meta.depth >> mip, (size_t)1);
+}
+
+uint64_t countPixels(const DirectX::Image* images, size_t count) {
+    uint64_t pixels = 0;
+    for (size_t i = 0; i < count; ++i)
+        pixels += (uint64_t)images[i].width * images[i].height;
+    return pixels;
+}
+
+// サブリソースの表示名。配列とボリュームの場合のみ番号を付ける。
+std::string getSubresourceName(const DirectX::TexMetadata& meta, size_t mip, size_t item, size_t slice) {
+    std::string name = "mip " + std::to_string(mip);
+    if (meta.arraySize > 1) name += " item " + std::to_string(item);
+    if (meta.dimension == DirectX::TEX_DIMENSION_TEXTURE3D) name += " slice " + std::to_string(slice);
+    return name;
+}
+
+double getRatio(double count, double total) {
+    return total > 0 ? count / total : 0.0;
+}
+
+// counts[0..size)のうち多いものから順にlimit個を「番号:割合」の形で並べる。
+std::string formatTopCounts(const uint64_t* counts, int size, int limit) {
+    std::vector<int> order(size);
+    for (int i = 0; i < size; ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [counts](int a, int b) { return counts[a] > counts[b]; });
+
+    uint64_t total = 0;
+    for (int i = 0; i < size; ++i)
+        total += counts[i];
+
+    std::string text;
+    for (int i = 0; i < std::min(limit, size) && counts[order[i]] > 0; ++i) {
+        char item[32];
+        snprintf(item, sizeof(item), " %d:%.1f%%", order[i], getRatio((double)counts[order[i]], (double)total) * 100);
+        text += item;
+    }
+    return text;
+}
+
+// --verboseで表示するエンコーダーの統計を1行ずつ返す。候補数と改善の反復回数は1ブロックあたりの平均。
+// --dedupの場合、BC6H,BC7の統計は実際に圧縮したブロックだけを数える。
+// --refineの場合は、最初の圧縮と圧縮し直したブロックの両方を数える。
+std::vector<std::string> formatEncoderStats(DXGI_FORMAT format, const EncoderStatsSum& stats) {
+    std::vector<std::string> lines;
+    char line[256];
+    if (stats.refineBlocks > 0) {
+        snprintf(line, sizeof(line), "refine %llu of %llu blocks %6.2f%%  improved %6.2f%%", (unsigned long long)stats.refined,
+                 (unsigned long long)stats.refineBlocks, getRatio((double)stats.refined, (double)stats.refineBlocks) * 100,
+                 getRatio((double)stats.refineImproved, (double)stats.refined) * 100);
+        lines.push_back(line);
+    }
+    if (stats.dedupBlocks > 0) {
+        snprintf(line, sizeof(line), "dedup %llu blocks  hit %6.2f%%", (unsigned long long)stats.dedupBlocks,
+                 getRatio((double)stats.dedupHits, (double)stats.dedupBlocks) * 100);
+        lines.push_back(line);
+    }
+    if (format == DXGI_FORMAT_BC7_UNORM) {
+        auto& bc7 = stats.bc7;
+        double blocks = (double)bc7.blocks;
+        snprintf(line, sizeof(line), "BC7 %llu blocks  solid %6.2f%%", (unsigned long long)bc7.blocks,
+                 getRatio((double)bc7.solid, blocks) * 100);
+        lines.push_back(line);
+        for (int mode = 0; mode < 8; ++mode) {
+            // 試していないモードは表示しない。
+            if (bc7.mode[mode] == 0 && bc7.candidates[mode] == 0 && bc7.pruned[mode] == 0)
+                continue;
+            int length = snprintf(line, sizeof(line), "mode %d %6.2f%%  candidates %6.2f  pruned %6.2f  refine %5.2f (%5.1f%% improved)",
+                                  mode, getRatio((double)bc7.mode[mode], blocks) * 100, getRatio((double)bc7.candidates[mode], blocks),
+                                  getRatio((double)bc7.pruned[mode], blocks), getRatio((double)bc7.refine_iterations[mode], blocks),
+                                  getRatio((double)bc7.refine_improved[mode], (double)bc7.refine_iterations[mode]) * 100);
+            std::string text(line, std::min((size_t)length, sizeof(line) - 1));
+            if (mode == 4 || mode == 5)
+                text += "  rotation" + formatTopCounts(bc7.rotation[mode], 4, 4);
+            else if (mode != 6)
+                text += "  partition" + formatTopCounts(bc7.partition[mode], mode == 0 ? 16 : 64, 3);
+            lines.push_back(text);
+        }
+    }
+    if (format == DXGI_FORMAT_BC6H_UF16) {
+        auto& bc6h = stats.bc6h;
+        double blocks = (double)bc6h.blocks;
+        snprintf(line, sizeof(line), "BC6H %llu blocks  solid %6.2f%%  candidates %6.2f  pruned %6.2f  partition%s",
+                 (unsigned long long)bc6h.blocks, getRatio((double)bc6h.solid, blocks) * 100, getRatio((double)bc6h.candidates, blocks),
+                 getRatio((double)bc6h.pruned, blocks), formatTopCounts(bc6h.partition, 32, 3).c_str());
+        lines.push_back(line);
+        snprintf(line, sizeof(line), "refine 1 region %5.2f (%5.1f%% improved)  2 regions %5.2f (%5.1f%% improved)",
+                 getRatio((double)bc6h.refine_iterations[0], blocks),
+                 getRatio((double)bc6h.refine_improved[0], (double)bc6h.refine_iterations[0]) * 100,
+                 getRatio((double)bc6h.refine_iterations[1], blocks),
+                 getRatio((double)bc6h.refine_improved[1], (double)bc6h.refine_iterations[1]) * 100);
+        lines.push_back(line);
+        for (int mode = 0; mode < 14; ++mode) {
+            uint64_t tested = bc6h.mode_passed[mode] + bc6h.mode_skipped[mode];
+            if (bc6h.mode[mode] == 0 && tested == 0)
+                continue;
+            // モードの番号はBC6Hの仕様に合わせて1から数える。
+            int length = snprintf(line, sizeof(line), "mode %2d %6.2f%%", mode + 1, getRatio((double)bc6h.mode[mode], blocks) * 100);
+            if (tested > 0)
+                snprintf(line + length, sizeof(line) - length, "  span test passed %6.2f%%",
+                         getRatio((double)bc6h.mode_passed[mode], (double)tested) * 100);
+            lines.push_back(line);
+        }
+    }
+    return lines;
+}
+
+// dstImagesはlayoutImagesで配置した出力先。timesがnullptrでない場合はサブリソースごとの時間を記録し、
+// statsがnullptrでない場合はエンコーダーの統計を集計する。
+// batcherがnullptrでない場合、小さいサブリソースはjobの分としてbatcherに渡し、ほかのファイルとまとめて圧縮する。
+// サブリソースごとの時間と統計、サブリソース全体の誤差が必要な場合は渡さない。
+void compressImages(util::ThreadPool& pool, const DirectX::ScratchImage& images, const Spec& spec,
+                    const std::vector<DirectX::Image>& dstImages, SubresourceTimes* times, EncoderStatsTotal* stats,
+                    const Job& job, SharedBatcher* batcher) {
+    auto& meta = images.GetMetadata();
+    auto settings = initEncoderSettings(spec);
+    bool refineRatio = settings.refine && settings.refineRatio > 0;
+    bool shareSmalls = batcher && !times && !stats && !refineRatio;
+
+    std::vector<CompressTask> tasks;
+    std::vector<SmallSurface> smalls;
+    std::vector<RefineTarget> refineTargets(refineRatio ? dstImages.size() : 0);
+
+    for (size_t mip = 0; mip < meta.mipLevels; ++mip) {
+        for (size_t item = 0; item < meta.arraySize; ++item) {
+            for (size_t slice = 0, depth = getDepth(meta, mip); slice < depth; ++slice) {
+                auto src = images.GetImage(mip, item, slice);
+                size_t index = meta.ComputeIndex(mip, item, slice);
+                auto dst = &dstImages[index];
+
+                rgba_surface surface;
+                surface.ptr = src->pixels;
+                surface.width = (int32_t)src->width;
+                surface.height = (int32_t)src->height;
+                surface.stride = (int32_t)src->rowPitch;
+                float* errors = refineRatio ? refineTargets[index].init(surface, dst->pixels, dst->rowPitch, index) : nullptr;
+                if (isSmallSurface(surface))
+                    smalls.push_back({ surface, dst->pixels, dst->rowPitch, index, errors });
+                else
+                    appendBands(tasks, surface, dst->pixels, dst->rowPitch, index, errors);
+            }
+        }
+    }
+    std::vector<CompressBatch> batches;
+    if (shareSmalls)
+        batcher->add(job, settings, smalls);
+    else
+        appendBatches(batches, smalls);
+
+    // 大きいタスクから投入して、小さいミップのタスクで隙間を埋めるようにする。
+    std::stable_sort(tasks.begin(), tasks.end(), [](const CompressTask& a, const CompressTask& b) {
+        return (int64_t)a.surface.width * a.numRows > (int64_t)b.surface.width * b.numRows;
+    });
+
+    util::TaskGroup group;
+    for (auto& task : tasks) {
+        pool.submit(group, [&settings, task, times, stats] { runCompressTask(task, settings, times, stats); });
+    }
+    for (auto& batch : batches) {
+        pool.submit(group, [&settings, &batch, times, stats] { runCompressBatch(batch, settings, times, stats); });
+    }
+    pool.wait(group);
+
+    if (refineRatio) {
+        std::vector<RefineTarget*> targets;
+        for (auto& target : refineTargets) {
+            if (!target.errors.empty())
+                targets.push_back(&target);
+        }
+        refineSubresources(pool, targets, settings, times, stats);
+    }
+}
+
+// 最上位レベルを圧縮しながら、下位のレベルを帯単位で生成してすぐに圧縮する。
+// 保持するのは生成中のレベルとその1つ上のレベルだけで、ミップマップ全体を非圧縮で持つことはない。
+// metaは出力のメタデータで、mipLevelsは生成するレベル数。
+// timesに記録するサブリソースごとの時間には、そのレベルの生成にかかった時間も含む。
+// jobとbatcherはcompressImagesと同じで、末尾のレベルをほかのファイルとまとめて圧縮する。
+void compressMipChain(util::ThreadPool& pool, const DirectX::ScratchImage& images, const Spec& spec,
+                      const DirectX::TexMetadata& meta, const std::vector<DirectX::Image>& dstImages, SubresourceTimes* times,
+                      EncoderStatsTotal* stats, const Job& job, SharedBatcher* batcher) {
+    auto settings = initEncoderSettings(spec);
+    bool refineRatio = settings.refine && settings.refineRatio > 0;
+    bool shareSmalls = batcher && !times && !stats && !refineRatio;
+    size_t bpp = DirectX::BitsPerPixel(images.GetMetadata().format);
+    auto filter = spec.mipFilter;
+    bool srgb = isMipSrgb(spec);
+
+    // levels[mip * arraySize + item]は各レベルの画像。
+    // 1以降のレベルは、アイテムごとに奇数レベル用と偶数レベル用の2つの作業領域を交互に使う。
+    std::vector<util::Image> levels(meta.mipLevels * meta.arraySize);
+    std::vector<std::vector<uint8_t>> buffers(meta.arraySize * 2);
+
+    // レベル0は元画像を指し、それ以外はbufferに領域を確保する。
+    auto initLevel = [&](size_t mip, size_t item, std::vector<uint8_t>& buffer) -> util::Image& {
+        auto& level = levels[mip * meta.arraySize + item];
+        if (mip == 0) {
+            auto src = images.GetImage(0, item, 0);
+            level.set(src->pixels, src->width, src->height, src->rowPitch, bpp);
+        }
+        else {
+            size_t width = std::max(meta.width >> mip, (size_t)1);
+            size_t height = std::max(meta.height >> mip, (size_t)1);
+            size_t stride = width * (bpp >> 3);
+            if (buffer.size() < stride * height)
+                buffer.resize(stride * height);
+            level.set(buffer.data(), width, height, stride, bpp);
+        }
+        return level;
+    };
+    auto getSurface = [](const util::Image& level) {
+        rgba_surface surface;
+        surface.ptr = (uint8_t*)level.getData();
+        surface.width = (int32_t)level.getWidth();
+        surface.height = (int32_t)level.getHeight();
+        surface.stride = (int32_t)level.getBytesPerRow();
+        return surface;
+    };
+
+    // 小さいレベル(ミップマップの末尾)は、大きいレベルの後でまとめて生成して圧縮する。
+    size_t tailMip = 0;
+    while (tailMip < meta.mipLevels) {
+        rgba_surface surface = {};
+        surface.width = (int32_t)std::max(meta.width >> tailMip, (size_t)1);
+        surface.height = (int32_t)std::max(meta.height >> tailMip, (size_t)1);
+        if (isSmallSurface(surface))
+            break;
+        ++tailMip;
+    }
+
+    // --refineで割合を指定した場合、1回目の圧縮が終わったレベルを、作業領域を次に使う前に圧縮し直す。
+    std::vector<RefineTarget> refineTargets(refineRatio ? meta.mipLevels * meta.arraySize : 0);
+    size_t refinedMip = 0;
+    auto refineLevels = [&](size_t endMip) {
+        if (!refineRatio) return;
+        std::vector<RefineTarget*> targets;
+        for (; refinedMip < endMip; ++refinedMip) {
+            for (size_t item = 0; item < meta.arraySize; ++item)
+                targets.push_back(&refineTargets[refinedMip * meta.arraySize + item]);
+        }
+        refineSubresources(pool, targets, settings, times, stats);
+    };
+
+    // 待つのはこのミップマップのタスクだけで、同じプールで処理中のほかのジョブは待たない。
+    util::TaskGroup group;
+    for (size_t mip = 0; mip < tailMip; ++mip) {
+        // 1つ上のレベルの生成が終わるのを待つ。レベル1はレベル0(元画像)から生成するので待たない。
+        if (mip >= 2) {
+            pool.wait(group);
+            refineLevels(mip);
+        }
+
+        for (size_t item = 0; item < meta.arraySize; ++item) {
+            auto& level = initLevel(mip, item, buffers[item * 2 + (mip & 1)]);
+            auto surface = getSurface(level);
+
+            size_t index = meta.ComputeIndex(mip, item, 0);
+            auto dst = &dstImages[index];
+            float* errors = refineRatio ? refineTargets[mip * meta.arraySize + item].init(surface, dst->pixels, dst->rowPitch, index) : nullptr;
+            std::vector<CompressTask> tasks;
+            appendBands(tasks, surface, dst->pixels, dst->rowPitch, index, errors);
+
+            const util::Image* upper = mip == 0 ? nullptr : &levels[(mip - 1) * meta.arraySize + item];
+            for (auto& task : tasks) {
+                pool.submit(group, [&settings, task, upper, &level, filter, srgb, times, stats] {
+                    int64_t begin = times ? util::Tracer::get().now() : 0;
+                    if (upper) {
+                        util::TraceScope scope("downsample", "task");
+                        size_t firstRow = task.firstRow * 4;
+                        size_t numRows = std::min(task.numRows * 4, level.getHeight() - firstRow);
+                        util::downsampleRows(*upper, level, firstRow, numRows, filter, srgb);
+                    }
+                    runCompressTask(task, settings, nullptr, stats);
+                    if (times)
+                        times->add(task.subresource, begin, util::Tracer::get().now());
+                });
+            }
+        }
+    }
+    pool.wait(group);
+    refineLevels(tailMip);
+
+    if (tailMip == meta.mipLevels)
+        return;
+
+    // 末尾のレベルは数KB程度なので、このスレッドで順に生成し、全アイテムの分を並べて圧縮する。
+    // 圧縮が終わるまで全レベルを保持するので、作業領域はレベルごとに分ける。
+    std::vector<std::vector<uint8_t>> tailBuffers((meta.mipLevels - tailMip) * meta.arraySize);
+    std::vector<SmallSurface> smalls;
+    for (size_t item = 0; item < meta.arraySize; ++item) {
+        for (size_t mip = tailMip; mip < meta.mipLevels; ++mip) {
+            auto& level = initLevel(mip, item, tailBuffers[(mip - tailMip) * meta.arraySize + item]);
+            if (mip > 0) {
+                util::TraceScope scope("downsample", "task");
+                util::downsampleRows(levels[(mip - 1) * meta.arraySize + item], level, 0, level.getHeight(), filter, srgb);
+            }
+            size_t index = meta.ComputeIndex(mip, item, 0);
+            auto surface = getSurface(level);
+            float* errors = refineRatio ? refineTargets[mip * meta.arraySize + item].init(surface, dstImages[index].pixels,
+                                                                                          dstImages[index].rowPitch, index) : nullptr;
+            smalls.push_back({ surface, dstImages[index].pixels, dstImages[index].rowPitch, index, errors });
+        }
+    }
+
+    if (shareSmalls) {
+        batcher->add(job, settings, smalls);
+        return;
+    }
+
+    std::vector<CompressBatch> batches;
+    appendBatches(batches, smalls);
+    for (auto& batch : batches) {
+        pool.submit(group, [&settings, &batch, times, stats] { runCompressBatch(batch, settings, times, stats); });
+    }
+    pool.wait(group);
+    refineLevels(meta.mipLevels);
+}
+
+// ファイルの内容をjob.allocateOutputで確保した領域に読み込む。
+bool readFileToOutput(const std::filesystem::path& path, Job& job) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) return false;
+    job.outputSize = (size_t)file.tellg();
+    job.outputData = job.allocateOutput(job.outputSize);
+    if (!job.outputData) return false;
+    file.seekg(0);
+    return (bool)file.read((char*)job.outputData, (std::streamsize)job.outputSize);
+}
+
+// 出力キャッシュのキー。入力ファイルの内容と、出力に影響するすべての設定から求める。
+// 変換や圧縮の手順を変えて出力が変わる場合に更新し、古いキャッシュを使わないようにする。
+const int32_t kPipelineRevision = 6;
+
+std::string computeCacheKey(const Spec& spec, const uint8_t* source, size_t sourceSize) {
+    std::vector<uint8_t> settings;
+    auto append = [&settings](auto value) {
+        auto p = reinterpret_cast<const uint8_t*>(&value);
+        settings.insert(settings.end(), p, p + sizeof(value));
+    };
+    settings.insert(settings.end(), VERSION, VERSION + sizeof(VERSION));
+    append((int32_t)ISPC_TEXCOMP_VERSION);
+    append(kPipelineRevision);
+    append((int32_t)spec.format);
+    append((int32_t)spec.level);
+    append(spec.mipmapSpecified ? spec.mipLevels : UINT32_MAX);
+    append((int32_t)spec.mipFilter);
+    append(spec.mipSrgbSpecified);
+    append(spec.forceRgbSpecified);
+    append(spec.linearColorSpecified);
+    // --streamを指定しない場合のキーは変えない。帯単位の変換は通常の変換と同じ出力になるとは限らない。
+    if (spec.streamSpecified)
+        append(spec.streamSpecified);
+    // --autoFormatを指定しない場合のキーは変えない。選ばれるフォーマットは入力の内容で決まる。
+    if (spec.autoFormatSpecified)
+        append(spec.autoFormatSpecified);
+
+    auto encoder = initEncoderSettings(spec);
+    // --refineを指定しない場合のキーは変えない。
+    if (encoder.refine) {
+        append(spec.refinePsnr);
+        append(spec.refinePercent);
+    }
+
+    // 構造体のパディングを含めないよう、解決済みのプロファイルはメンバーごとに追加する。
+    if (spec.format == DXGI_FORMAT_BC6H_UF16) {
+        auto& bc6h = encoder.bc6h;
+        append(bc6h.slow_mode);
+        append(bc6h.fast_mode);
+        append(bc6h.refineIterations_1p);
+        append(bc6h.refineIterations_2p);
+        append(bc6h.fastSkipTreshold);
+    }
+    if (spec.format == DXGI_FORMAT_BC7_UNORM) {
+        auto& bc7 = encoder.bc7;
+        for (bool mode : bc7.mode_selection) append(mode);
+        for (int iterations : bc7.refineIterations) append(iterations);
+        append(bc7.skip_mode2);
+        append(bc7.fastSkipTreshold_mode1);
+        append(bc7.fastSkipTreshold_mode3);
+        append(bc7.fastSkipTreshold_mode7);
+        append(bc7.mode45_channel0);
+        append(bc7.refineIterations_channel);
+        append(bc7.channels);
+    }
+
+    char key[33];
+    snprintf(key, sizeof(key), "%016llx%016llx",
+             (unsigned long long)util::hash64(source, sourceSize),
+             (unsigned long long)util::hash64(settings.data(), settings.size()));
+    return key;
+}
+
+std::filesystem::path getCachePath(const Spec& spec, const std::string& key) {
+    return std::filesystem::path(spec.cacheDir) / key.substr(0, 2) / (key + ".dds");
+}
+
+// 可能であればハードリンクを作成し、できなければコピーする。
+bool linkOrCopyFile(const std::filesystem::path& from, const std::filesystem::path& to) {
+    std::error_code ec;
+    auto dir = to.parent_path();
+    if (!dir.empty())
+        std::filesystem::create_directories(dir, ec);
+    std::filesystem::remove(to, ec);
+    std::filesystem::create_hard_link(from, to, ec);
+    if (ec) {
+        ec.clear();
+        std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing, ec);
+    }
+    return !ec;
+}
+
+void createOutputDirectory(const std::wstring& output) {
+    std::error_code ec;
+    auto dir = std::filesystem::path(output).parent_path();
+    if (!dir.empty())
+        std::filesystem::create_directories(dir, ec);
+}
+
+// 出力先のフォルダを作成し、既存の出力ファイルを削除する。
+// 出力がキャッシュへのハードリンクの場合に、キャッシュを上書きしないようにするため。
+void prepareOutput(const std::wstring& output) {
+    createOutputDirectory(output);
+    std::error_code ec;
+    std::filesystem::remove(output, ec);
+}
+
+// 書き込み途中のファイルを置く、pathと同じフォルダの一時ファイル名。完成してからrenameで置き換える。
+std::filesystem::path getTempPath(const std::filesystem::path& path) {
+    auto temp = path;
+    temp += L"." + std::to_wstring(std::random_device()()) + L".tmp";
+    return temp;
+}
+
+const char* cacheLookupStage(Job& job) {
+    // ピクセルを直接渡された場合はキャッシュしない。
+    if (job.spec.cacheDir.empty() || job.rawWidth != 0)
+        return nullptr;
+
+    // 入力ファイルが読めない場合は、読み込みの段階でエラーにする。
+    // 読み込んだ内容は読み込みの段階で使い、同じファイルを2回読まないようにする。
+    if (!job.sourceData) {
+        if (readFile(job.spec.source, job.sourceBytes))
+            job.cacheKey = computeCacheKey(job.spec, job.sourceBytes.data(), job.sourceBytes.size());
+        else
+            job.sourceBytes.clear();
+    }
+    else {
+        job.cacheKey = computeCacheKey(job.spec, job.sourceData, job.sourceSize);
+    }
+    if (job.cacheKey.empty())
+        return nullptr;
+
+    std::error_code ec;
+    auto cached = getCachePath(job.spec, job.cacheKey);
+    if (!std::filesystem::exists(cached, ec))
+        return nullptr;
+    if (job.allocateOutput ? readFileToOutput(cached, job) : linkOrCopyFile(cached, job.spec.output)) {
+        job.finished = true;
+        std::vector<uint8_t>().swap(job.sourceBytes);
+    }
+    return nullptr;
+}
+
+const char* loadStage(Job& job) {
+    if (job.rawWidth != 0) {
+        job.images = std::make_unique<DirectX::ScratchImage>();
+        if (FAILED(job.images->Initialize2D(DXGI_FORMAT_R8G8B8A8_UNORM, job.rawWidth, job.rawHeight, 1, 1)))
+            return "DirectX::ScratchImage::Initialize2D failed.";
+        auto image = job.images->GetImage(0, 0, 0);
+        for (size_t y = 0; y < image->height; ++y)
+            memcpy(image->pixels + y * image->rowPitch, job.sourceData + y * job.rawRowPitch, image->width * 4);
+        job.pixels = (uint64_t)job.rawWidth * job.rawHeight;
+        return nullptr;
+    }
+
+    if (!job.sourceData && !job.sourceBytes.empty()) {
+        job.images = loadImage(job.spec, job.sourceBytes.data(), job.sourceBytes.size());
+        std::vector<uint8_t>().swap(job.sourceBytes);
+    }
+    else {
+        job.images = loadImage(job.spec, job.sourceData, job.sourceSize);
+    }
+    if (!job.images)
+        return "DirectX::LoadFromXXXFile failed.";
+    job.pixels = countPixels(job.images->GetImages(), job.images->GetImageCount());
+    return nullptr;
+}
+
+const char* convertStage(util::ThreadPool& pool, Job& job) {
+    // 同じフォーマットでもリニアカラー変換だけは行う。
+    if (shouldConvertImage(job.spec, job.images->GetMetadata()) || job.spec.linearColorSpecified) {
+        job.images = convertImage(pool, job.spec, std::move(job.images));
+        if (!job.images)
+            return "DirectX::Convert failed.";
+    }
+    return nullptr;
+}
+
+const char* analyzeStage(util::ThreadPool& pool, Job& job) {
+    auto& spec = job.spec;
+    if (!spec.autoFormatSpecified || spec.format == DXGI_FORMAT_BC4_UNORM ||
+        spec.format == DXGI_FORMAT_BC5_UNORM || spec.format == DXGI_FORMAT_BC6H_UF16)
+        return nullptr;
+    // 変換の段階の後なので、BC1からBC7(BC6H以外)の入力は常にRGBA8になっている。
+    if (job.images->GetMetadata().format != DXGI_FORMAT_R8G8B8A8_UNORM)
+        return nullptr;
+
+    auto analysis = analyzeImages(pool, *job.images);
+    job.analysis = chooseFormat(spec, analysis);
+    return nullptr;
+}
+
+const char* mipmapStage(Job& job) {
+    if (job.spec.mipmapSpecified && !shouldFuseMipmaps(job.spec, job.images->GetMetadata())) {
+        job.images = generateMipmaps(std::move(job.images), job.spec);
+        if (!job.images)
+            return "DirectX::GenerateMipMaps failed.";
+        job.pixels = countPixels(job.images->GetImages(), job.images->GetImageCount());
+    }
+    return nullptr;
+}
+
+// batcherはcompressImagesと同じで、--batchの場合のみ設定する。
+const char* compressStage(util::ThreadPool& pool, Job& job, SharedBatcher* batcher) {
+    // 出力ファイルをメモリマップし、カーネルに直接書き込ませる。
+    auto srcMeta = job.images->GetMetadata();
+    bool fuseMipmaps = shouldFuseMipmaps(job.spec, srcMeta);
+    if (fuseMipmaps)
+        srcMeta.mipLevels = getMipLevelCount(srcMeta, job.spec.mipLevels);
+    auto meta = getOutputMetadata(job.spec.format, srcMeta);
+    size_t headerSize = 0;
+    if (FAILED(DirectX::EncodeDDSHeader(meta, DirectX::DDS_FLAGS_NONE, nullptr, 0, headerSize)))
+        return "DirectX::EncodeDDSHeader failed.";
+    std::vector<DirectX::Image> dstImages;
+    size_t dataSize = layoutImages(meta, nullptr, dstImages);
+
+    uint8_t* data;
+    if (job.allocateOutput) {
+        job.outputSize = headerSize + dataSize;
+        job.outputData = job.allocateOutput(job.outputSize);
+        if (!job.outputData)
+            return "Failed to allocate the output buffer.";
+        data = job.outputData;
+    }
+    else {
+        prepareOutput(job.spec.output);
+        job.output = std::make_unique<util::MappedFile>();
+        if (!job.output->create(job.spec.output.c_str(), headerSize + dataSize))
+            return "Failed to map the output file.";
+        data = job.output->getData();
+    }
+    if (FAILED(DirectX::EncodeDDSHeader(meta, DirectX::DDS_FLAGS_NONE, data, headerSize, headerSize)))
+        return "DirectX::EncodeDDSHeader failed.";
+    layoutImages(meta, data + headerSize, dstImages);
+    job.pixels = countPixels(dstImages.data(), dstImages.size());
+
+    std::unique_ptr<SubresourceTimes> times;
+    std::unique_ptr<EncoderStatsTotal> stats;
+    if (job.spec.verboseSpecified) {
+        times = std::make_unique<SubresourceTimes>(dstImages.size());
+        if (job.spec.format == DXGI_FORMAT_BC6H_UF16 || job.spec.format == DXGI_FORMAT_BC7_UNORM || job.spec.dedupSpecified)
+            stats = std::make_unique<EncoderStatsTotal>();
+    }
+    if (fuseMipmaps)
+        compressMipChain(pool, *job.images, job.spec, meta, dstImages, times.get(), stats.get(), job, batcher);
+    else
+        compressImages(pool, *job.images, job.spec, dstImages, times.get(), stats.get(), job, batcher);
+    job.images.reset();
+
+    if (stats)
+        job.encoderStats = formatEncoderStats(job.spec.format, stats->get());
+
+    if (times) {
+        for (size_t mip = 0; mip < meta.mipLevels; ++mip) {
+            for (size_t item = 0; item < meta.arraySize; ++item) {
+                for (size_t slice = 0, depth = getDepth(meta, mip); slice < depth; ++slice) {
+                    size_t index = meta.ComputeIndex(mip, item, slice);
+                    StageTiming timing;
+                    timing.name = getSubresourceName(meta, mip, item, slice);
+                    timing.seconds = times->getSeconds(index);
+                    timing.pixels = (uint64_t)dstImages[index].width * dstImages[index].height;
+                    timing.detail = true;
+                    job.timings.push_back(timing);
+                }
+            }
+        }
+    }
+    return nullptr;
+}
+
+const char* saveStage(Job& job) {
+    // 圧縮結果は出力ファイルに直接書き込まれているので、閉じるだけでよい。
+    if (job.output) {
+        job.output->close();
+        job.output.reset();
+    }
+    return nullptr;
+}
+
+// キャッシュへの保存に失敗しても変換自体は成功しているので、エラーにはしない。
+const char* cacheStoreStage(Job& job) {
+    if (job.cacheKey.empty())
+        return nullptr;
+
+    std::error_code ec;
+    auto cached = getCachePath(job.spec, job.cacheKey);
+    if (std::filesystem::exists(cached, ec))
+        return nullptr;
+
+    // 他のプロセスが同じエントリを書き込んでいる場合に備えて、一時ファイルから置き換える。
+    auto temp = getTempPath(cached);
+    bool written;
+    if (job.allocateOutput) {
+        std::ofstream file(temp, std::ios::binary);
+        written = (bool)file.write((const char*)job.outputData, (std::streamsize)job.outputSize);
+        file.close();
+        if (!written) std::filesystem::remove(temp, ec);
+    }
+    else {
+        written = linkOrCopyFile(job.spec.output, temp);
+    }
+    if (written) {
+        std::filesystem::rename(temp, cached, ec);
+        if (ec) std::filesystem::remove(temp, ec);
+    }
+    return nullptr;
+}
+
+#ifdef _WIN32
+
+// ストリーミング変換で1度に読み込む行数。
+const UINT kStreamBandRows = 4096;
+
+bool canStream(const Spec& spec) {
+    if (!spec.streamSpecified) return false;
+    // --autoFormatは画像全体を解析してからフォーマットを決める。
+    if (spec.autoFormatSpecified) return false;
+    if (spec.mipmapSpecified && spec.mipLevels != 1) return false;
+    if (spec.format == DXGI_FORMAT_BC6H_UF16)
+        return false;
+    // --refineの割合は画像全体の誤差から選ぶ。
+    if (spec.refinePercent > 0) return false;
+
+    // DDS,TGA,HDRはWICを使わずに読み込むので、通常の変換を行う。
+    auto ext = std::filesystem::path(spec.source).extension().wstring();
+    std::transform(ext.begin(), ext.end(), ext.begin(), std::towlower);
+    return ext != L".dds" && ext != L".tga" && ext != L".hdr";
+}
+
+// headerに続けて、converterから帯単位で読み込んで圧縮したブロック行をpathに書き出す。
+const char* writeStreamedImage(util::ThreadPool& pool, const Spec& spec, IWICBitmapSource* converter, UINT width, UINT height,
+                               const std::vector<uint8_t>& header, const std::filesystem::path& path) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.write((const char*)header.data(), (std::streamsize)header.size()))
+        return "Failed to write the output file.";
+
+    size_t stride = (size_t)width * 4;
+    size_t bandRows = std::min((size_t)kStreamBandRows, (size_t)height);
+    size_t dstRowPitch = ROUNDUP(width, 4) / 4 * getBlockBytes(spec.format);
+
+    util::Image band(width, bandRows, stride, 32);
+    std::vector<uint8_t> blocks(dstRowPitch * ROUNDUP(bandRows, 4) / 4);
+    auto settings = initEncoderSettings(spec);
+
+    for (UINT y = 0; y < height; y += kStreamBandRows) {
+        UINT rows = std::min(kStreamBandRows, height - y);
+        WICRect rect = { 0, (INT)y, (INT)width, (INT)rows };
+        if (FAILED(converter->CopyPixels(&rect, (UINT)stride, (UINT)(stride * rows), (BYTE*)band.getData())))
+            return "IWICBitmapSource::CopyPixels failed.";
+
+        rgba_surface surface;
+        surface.ptr = (uint8_t*)band.getData();
+        surface.width = (int32_t)width;
+        surface.height = (int32_t)rows;
+        surface.stride = (int32_t)stride;
+
+        if (spec.linearColorSpecified) {
+            // 帯を行単位に分割し、その場でリニアカラーに変換する。
+            size_t convertRows = std::max(kBandBytes / stride, (size_t)1);
+            pool.parallelFor((rows + convertRows - 1) / convertRows, [&](size_t i) {
+                for (size_t row = i * convertRows, end = std::min(row + convertRows, (size_t)rows); row < end; ++row) {
+                    auto pixels = surface.ptr + row * stride;
+                    util::convertRowToRGBA8(pixels, pixels, width, util::PixelLayout::RGBA, true);
+                }
+            });
+        }
+
+        std::vector<CompressTask> tasks;
+        appendBands(tasks, surface, blocks.data(), dstRowPitch, 0);
+        util::TaskGroup group;
+        for (auto& task : tasks) {
+            pool.submit(group, [&settings, task] { runCompressTask(task, settings, nullptr, nullptr); });
+        }
+        pool.wait(group);
+
+        if (!file.write((const char*)blocks.data(), (std::streamsize)(dstRowPitch * ROUNDUP(rows, 4) / 4)))
+            return "Failed to write the output file.";
+    }
+
+    file.close();
+    if (!file)
+        return "Failed to write the output file.";
+    return nullptr;
+}
+
+// 最上位レベルを帯単位で読み込み、変換、圧縮して、圧縮済みのブロック行を順に書き出す。
+// WICで開けない場合はhandledをfalseのまま返し、通常の変換に任せる。
+const char* streamImage(util::ThreadPool& pool, const Spec& spec, bool& handled) {
+    using Microsoft::WRL::ComPtr;
+    handled = false;
+
+    ComPtr<IWICImagingFactory> factory;
+    if (FAILED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory))))
+        return nullptr;
+    ComPtr<IWICBitmapDecoder> decoder;
+    if (FAILED(factory->CreateDecoderFromFilename(spec.source.c_str(), nullptr, GENERIC_READ,
+                                                  WICDecodeMetadataCacheOnDemand, &decoder)))
+        return nullptr;
+    ComPtr<IWICBitmapFrameDecode> frame;
+    UINT width, height;
+    if (FAILED(decoder->GetFrame(0, &frame)) || FAILED(frame->GetSize(&width, &height)))
+        return nullptr;
+
+    ComPtr<IWICFormatConverter> converter;
+    if (FAILED(factory->CreateFormatConverter(&converter)) ||
+        FAILED(converter->Initialize(frame.Get(), GUID_WICPixelFormat32bppRGBA, WICBitmapDitherTypeNone, nullptr, 0, WICBitmapPaletteTypeCustom)))
+        return nullptr;
+
+    handled = true;
+
+    DirectX::TexMetadata meta = {};
+    meta.width = width;
+    meta.height = height;
+    meta.depth = 1;
+    meta.arraySize = 1;
+    meta.mipLevels = 1;
+    meta.format = spec.format;
+    meta.dimension = DirectX::TEX_DIMENSION_TEXTURE2D;
+    size_t headerSize = 0;
+    if (FAILED(DirectX::EncodeDDSHeader(meta, DirectX::DDS_FLAGS_NONE, nullptr, 0, headerSize)))
+        return "DirectX::EncodeDDSHeader failed.";
+    std::vector<uint8_t> header(headerSize);
+    if (FAILED(DirectX::EncodeDDSHeader(meta, DirectX::DDS_FLAGS_NONE, header.data(), header.size(), headerSize)))
+        return "DirectX::EncodeDDSHeader failed.";
+
+    // 書き込みの途中で失敗した場合に、既存の出力を消したり不完全なDDSを残したりしないように、
+    // 一時ファイルに書き出してから出力を置き換える。出力がキャッシュへのハードリンクでも、
+    // renameはリンクを置き換えるだけなのでキャッシュは変わらない。
+    createOutputDirectory(spec.output);
+    std::filesystem::path output(spec.output);
+    auto temp = getTempPath(output);
+    auto error = writeStreamedImage(pool, spec, converter.Get(), width, height, header, temp);
+    std::error_code ec;
+    if (!error) {
+        std::filesystem::rename(temp, output, ec);
+        if (ec) error = "Failed to write the output file.";
+    }
+    if (error)
+        std::filesystem::remove(temp, ec);
+    return error;
+}
+
+#endif
+
+// WICのない環境ではストリーミングせず、常に通常の変換を行う。
+const char* streamStage(util::ThreadPool& pool, Job& job) {
+#ifdef _WIN32
+    if (!canStream(job.spec) || job.sourceData || job.allocateOutput)
+        return nullptr;
+
+    // ストリーミングではWICがファイルから直接読み込むので、キャッシュの確認で読み込んだ内容は解放しておく。
+    // WICで開けずに通常の変換に戻る場合は、読み込みの段階でファイルを読み直す。
+    std::vector<uint8_t>().swap(job.sourceBytes);
+    bool handled = false;
+    if (auto error = streamImage(pool, job.spec, handled))
+        return error;
+    if (!handled)
+        return nullptr;
+
+    // 出力は書き出し済みなので、キャッシュへの保存だけを行う。
+    job.finished = true;
+    return cacheStoreStage(job);
+#else
+    (void)pool;
+    (void)job;
+    return nullptr;
+#endif
+}
+
+}
+
+std::vector<Stage> makeStages(util::ThreadPool& pool, bool shareBatches) {
+    // 保存の前に、ほかのファイルとまとめた圧縮が終わるのを待つ。
+    // 圧縮の段階で失敗した場合は保存の段階を通らないので、そこで待つ。
+    std::shared_ptr<SharedBatcher> batcher;
+    if (shareBatches)
+        batcher = std::make_shared<SharedBatcher>(pool);
+    auto compress = [&pool, batcher](Job& job) {
+        auto error = compressStage(pool, job, batcher.get());
+        if (error && batcher) batcher->wait(job);
+        return error;
+    };
+    auto save = [batcher](Job& job) {
+        if (batcher) batcher->wait(job);
+        return saveStage(job);
+    };
+    return {
+        { "cache lookup", cacheLookupStage },
+        { "stream",       [&pool](Job& job) { return streamStage(pool, job); } },
+        { "load",         loadStage },
+        { "convert",      [&pool](Job& job) { return convertStage(pool, job); } },
+        { "analyze",      [&pool](Job& job) { return analyzeStage(pool, job); } },
+        { "mipmap",       mipmapStage },
+        { "compress",     compress },
+        { "save",         save },
+        { "cache store",  cacheStoreStage },
+    };
+}
+
+const char* runStage(const Stage& stage, Job& job) {
+    auto& tracer = util::Tracer::get();
+    if (!job.spec.verboseSpecified && !tracer.isEnabled())
+        return stage.run(job);
+
+    // 圧縮の段階はサブリソースごとの内訳を追加するので、段階の結果はその前に入れる。
+    size_t first = job.timings.size();
+    int64_t begin = tracer.now();
+    auto error = stage.run(job);
+    int64_t end = tracer.now();
+
+    if (tracer.isEnabled()) {
+        auto source = std::filesystem::path(job.spec.source).u8string();
+        tracer.record(stage.name, "stage", begin, end, "\"source\":\"" + util::escapeJson(source) + "\"");
+    }
+    if (job.spec.verboseSpecified) {
+        StageTiming timing;
+        timing.name = stage.name;
+        timing.seconds = (end - begin) / 1e6;
+        timing.pixels = job.pixels;
+        timing.peakBytes = util::getPeakMemoryUsage();
+        job.timings.insert(job.timings.begin() + first, timing);
+    }
+    return error;
+}
+
+bool loadImageFromFile(const std::wstring& path, DirectX::TexMetadata& meta, DirectX::ScratchImage& images) {
+    if (SUCCEEDED(DirectX::LoadFromDDSFile(path.c_str(), DirectX::DDS_FLAGS_NONE, &meta, images))) return true;
+    if (SUCCEEDED(DirectX::LoadFromTGAFile(path.c_str(), &meta, images))) return true;
+    if (SUCCEEDED(DirectX::LoadFromHDRFile(path.c_str(), &meta, images))) return true;
+#ifdef _WIN32
+    return SUCCEEDED(DirectX::LoadFromWICFile(path.c_str(), DirectX::WIC_FLAGS_NONE, &meta, images));
+#else
+    std::vector<uint8_t> data;
+    return readFile(path, data) && util::loadStbImage(data.data(), data.size(), &meta, images);
+#endif
+}
+
+bool loadImageFromMemory(const uint8_t* data, size_t size, DirectX::TexMetadata& meta, DirectX::ScratchImage& images) {
+    if (SUCCEEDED(DirectX::LoadFromDDSMemory(data, size, DirectX::DDS_FLAGS_NONE, &meta, images))) return true;
+    if (SUCCEEDED(DirectX::LoadFromTGAMemory(data, size, &meta, images))) return true;
+    if (SUCCEEDED(DirectX::LoadFromHDRMemory(data, size, &meta, images))) return true;
+#ifdef _WIN32
+    return SUCCEEDED(DirectX::LoadFromWICMemory(data, size, DirectX::WIC_FLAGS_NONE, &meta, images));
+#else
+    return util::loadStbImage(data, size, &meta, images);
+#endif
+}
+
+}
@@ -0,0 +1,123 @@
+﻿#ifndef PIPELINE_H__
+#define PIPELINE_H__
+
+#include <cstdint>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "DirectXTex.h"
+#include "mapped_file.h"
+#include "mipmap.h"
+#include "thread_pool.h"
+
+#define VERSION "1.1.0"
+
+namespace ddsconv {
+
+struct Level {
+    enum Type {
+        ULTRA_FAST,
+        VERY_FAST,
+        FAST,
+        BASIC,
+        SLOW,
+        VERY_SLOW,
+    };
+};
+
+struct Spec {
+    std::wstring source;
+    std::wstring output = L"output.dds";
+    std::wstring batch;
+    std::wstring cacheDir;
+    std::wstring trace;
+    std::string isa;
+    DXGI_FORMAT format = DXGI_FORMAT_BC7_UNORM;
+    Level::Type level = Level::ULTRA_FAST;
+    uint32_t mipLevels = 0;
+    uint32_t threads = 0;
+    // --refine。0以外の場合、PSNRがこれを下回るブロック、または誤差の大きい順にこの割合(%)のブロックを圧縮し直す。
+    float refinePsnr = 0;
+    float refinePercent = 0;
+    util::MipFilter mipFilter = util::MipFilter::Box;
+    bool outputSpecified = false;
+    bool forceRgbSpecified = false;
+    bool mipmapSpecified = false;
+    bool mipSrgbSpecified = false;
+    bool linearColorSpecified = false;
+    bool streamSpecified = false;
+    bool serveSpecified = false;
+    bool verboseSpecified = false;
+    bool dedupSpecified = false;
+    bool autoFormatSpecified = false;
+};
+
+// --verboseで表示する処理時間。peakBytesは段階の終了時点でのプロセスのメモリ使用量の最大値。
+// detailは圧縮の段階に含まれるサブリソースごとの内訳。
+struct StageTiming {
+    std::string name;
+    double seconds = 0;
+    uint64_t pixels = 0;
+    size_t peakBytes = 0;
+    bool detail = false;
+};
+
+// 1ファイル分の変換処理の状態。
+struct Job {
+    Spec spec;
+    // メモリ上の入力。sourceDataがnullptrの場合はspec.sourceのファイルを読み込む。
+    // rawWidthが0以外の場合は、rawWidth x rawHeightのRGBA8のピクセルで、行の間隔はrawRowPitch。
+    // それ以外の場合は画像ファイルの内容。
+    const uint8_t* sourceData = nullptr;
+    size_t sourceSize = 0;
+    uint32_t rawWidth = 0;
+    uint32_t rawHeight = 0;
+    size_t rawRowPitch = 0;
+    // キャッシュの確認のために読み込んだspec.sourceの内容。読み込みの段階でファイルを読み直さずに使い、解放する。
+    std::vector<uint8_t> sourceBytes;
+    // 設定されている場合は出力ファイルを作らず、これで確保した領域にDDSファイルの内容を書き込む。
+    // 確保できない場合はnullptrを返す。その場合もoutputSizeには必要なサイズが設定される。
+    std::function<uint8_t*(size_t size)> allocateOutput;
+    uint8_t* outputData = nullptr;
+    size_t outputSize = 0;
+    std::unique_ptr<DirectX::ScratchImage> images;
+    std::unique_ptr<util::MappedFile> output;
+    std::string cacheKey;
+    // 処理中の画像の総ピクセル数。ミップマップを含む。
+    uint64_t pixels = 0;
+    // spec.verboseSpecifiedの場合のみ記録する。
+    std::vector<StageTiming> timings;
+    // --verboseで表示するBC6H,BC7のエンコーダーと--dedupの統計。1行ずつ。
+    std::vector<std::string> encoderStats;
+    // --verboseで表示する--autoFormatの解析結果と選んだフォーマット。
+    std::string analysis;
+    const char* error = nullptr;
+    bool finished = false;
+};
+
+// 変換の各段階。失敗した場合はエラーメッセージを返す。
+// 以降の段階が不要になった場合はjob.finishedを設定する。
+struct Stage {
+    const char* name;
+    std::function<const char*(Job&)> run;
+};
+
+// キャッシュの確認から保存までの各段階を順に返す。圧縮などの並列処理にはpoolを使う。
+// 各段階は別々のスレッドから呼び出してよいが、1つのジョブに対しては順番に呼び出すこと。
+// shareBatchesの場合は、小さいサブリソースをファイルをまたいでまとめて圧縮する。
+// その場合、各段階はそれぞれ1つのスレッドから、ジョブの順に呼び出すこと(--batch)。
+std::vector<Stage> makeStages(util::ThreadPool& pool, bool shareBatches = false);
+
+// 段階を1つ実行する。--verboseの場合は処理時間をjob.timingsに追加し、トレースが有効な場合は区間を記録する。
+const char* runStage(const Stage& stage, Job& job);
+
+// 画像ファイルを読み込む。DDS,TGA,HDRはDirectXTexで、それ以外はWindowsではWIC、ほかの環境ではstb_imageで読み込む。
+bool loadImageFromFile(const std::wstring& path, DirectX::TexMetadata& meta, DirectX::ScratchImage& images);
+bool loadImageFromMemory(const uint8_t* data, size_t size, DirectX::TexMetadata& meta, DirectX::ScratchImage& images);
+
+}
+
+#endif
@@ -0,0 +1,49 @@
+﻿#include "stb_loader.h"
+
+#include <cstring>
+
+#include <memory>
+
+#define STBI_NO_STDIO
+#define STBI_NO_HDR
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+namespace util {
+
+namespace {
+
+struct StbFree {
+    void operator()(void* p) const noexcept { stbi_image_free(p); }
+};
+
+}
+
+bool loadStbImage(const uint8_t* data, size_t size, DirectX::TexMetadata* meta, DirectX::ScratchImage& image) {
+    if (size > INT32_MAX) return false;
+    auto buffer = static_cast<const stbi_uc*>(data);
+    int length = (int)size;
+
+    int width, height, channels;
+    bool is16 = stbi_is_16_bit_from_memory(buffer, length) != 0;
+    std::unique_ptr<void, StbFree> pixels;
+    if (is16)
+        pixels.reset(stbi_load_16_from_memory(buffer, length, &width, &height, &channels, 4));
+    else
+        pixels.reset(stbi_load_from_memory(buffer, length, &width, &height, &channels, 4));
+    if (!pixels) return false;
+
+    DXGI_FORMAT format = is16 ? DXGI_FORMAT_R16G16B16A16_UNORM : DXGI_FORMAT_R8G8B8A8_UNORM;
+    if (FAILED(image.Initialize2D(format, (size_t)width, (size_t)height, 1, 1)))
+        return false;
+
+    auto dst = image.GetImage(0, 0, 0);
+    size_t srcRowPitch = (size_t)width * (is16 ? 8 : 4);
+    for (size_t y = 0; y < dst->height; ++y)
+        memcpy(dst->pixels + y * dst->rowPitch, static_cast<const uint8_t*>(pixels.get()) + y * srcRowPitch, srcRowPitch);
+
+    if (meta) *meta = image.GetMetadata();
+    return true;
+}
+
+}
@@ -0,0 +1,17 @@
+﻿#ifndef STB_LOADER_H__
+#define STB_LOADER_H__
+
+#include <cstddef>
+#include <cstdint>
+
+#include "DirectXTex.h"
+
+namespace util {
+
+// WICを使えない環境向けに、stb_imageでPNG,JPEG,BMP,PSD,GIFを読み込む。
+// 16bitのPNGはR16G16B16A16_UNORM、それ以外はR8G8B8A8_UNORMの1枚の2D画像になる。
+bool loadStbImage(const uint8_t* data, size_t size, DirectX::TexMetadata* meta, DirectX::ScratchImage& image);
+
+}
+
+#endif
@@ -0,0 +1,150 @@
+﻿#include "thread_pool.h"
+
+#include <algorithm>
+#include <string>
+
+#include "trace.h"
+
+namespace util {
+
+namespace {
+
+// タスクを実行中のスレッドが属するプールとキューの番号。
+thread_local ThreadPool* tlsPool = nullptr;
+thread_local size_t tlsQueueIndex = 0;
+
+}
+
+ThreadPool::ThreadPool(size_t numThreads) {
+    if (numThreads == 0)
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    // キュー0はwait()を呼び出したスレッドが共用する。
+    for (size_t i = 0; i < numThreads; ++i)
+        mQueues.push_back(std::make_unique<Queue>());
+    mWorkers.reserve(numThreads - 1);
+    for (size_t i = 1; i < numThreads; ++i)
+        mWorkers.emplace_back(&ThreadPool::workerMain, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mCondition.notify_all();
+    for (auto& worker : mWorkers)
+        worker.join();
+}
+
+void ThreadPool::submit(TaskGroup& group, Task task) {
+    size_t index;
+    if (tlsPool == this) {
+        index = tlsQueueIndex;
+    }
+    else {
+        std::lock_guard<std::mutex> lock(mMutex);
+        index = mNextQueue++ % mQueues.size();
+    }
+
+    ++group.mPending;
+    {
+        auto& queue = *mQueues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back({ std::move(task), &group });
+        ++mQueued;
+    }
+    // 待機中のスレッドが条件を確認してから眠るまでの間に通知が失われないようにする。
+    { std::lock_guard<std::mutex> lock(mMutex); }
+    mCondition.notify_all();
+}
+
+void ThreadPool::wait(TaskGroup& group) {
+    auto prevPool = tlsPool;
+    auto prevIndex = tlsQueueIndex;
+    tlsPool = this;
+    tlsQueueIndex = 0;
+
+    // 自分の組のタスクを優先し、なければほかの組のタスクを手伝う。
+    while (group.mPending > 0) {
+        if (tryRunTask(0, &group) || tryRunTask(0, nullptr)) continue;
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [&] { return group.mPending == 0 || mQueued > 0; });
+    }
+
+    tlsPool = prevPool;
+    tlsQueueIndex = prevIndex;
+}
+
+void ThreadPool::parallelFor(size_t count, std::function<void(size_t)> const& func) {
+    TaskGroup group;
+    for (size_t i = 0; i < count; ++i)
+        submit(group, [&func, i] { func(i); });
+    wait(group);
+}
+
+void ThreadPool::workerMain(size_t index) {
+    tlsPool = this;
+    tlsQueueIndex = index;
+    Tracer::get().setThreadName("worker " + std::to_string(index));
+
+    for (;;) {
+        if (tryRunTask(index, nullptr)) continue;
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [&] { return mStop || mQueued > 0; });
+        if (mStop) return;
+    }
+}
+
+bool ThreadPool::tryRunTask(size_t index, TaskGroup* group) {
+    Entry entry;
+    if (group ? !popGroupTask(*group, entry) : !popTask(index, entry) && !stealTask(index, entry))
+        return false;
+
+    entry.task();
+
+    // 組の最後のタスクが完了したら、その組を待っているスレッドを起こす。
+    if (entry.group->mPending.fetch_sub(1) == 1) {
+        { std::lock_guard<std::mutex> lock(mMutex); }
+        mCondition.notify_all();
+    }
+    return true;
+}
+
+bool ThreadPool::popTask(size_t index, Entry& entry) {
+    auto& queue = *mQueues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) return false;
+    entry = std::move(queue.tasks.front());
+    queue.tasks.pop_front();
+    --mQueued;
+    return true;
+}
+
+bool ThreadPool::popGroupTask(TaskGroup& group, Entry& entry) {
+    for (auto& queue : mQueues) {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        auto it = std::find_if(queue->tasks.begin(), queue->tasks.end(), [&](const Entry& e) { return e.group == &group; });
+        if (it == queue->tasks.end()) continue;
+        entry = std::move(*it);
+        queue->tasks.erase(it);
+        --mQueued;
+        return true;
+    }
+    return false;
+}
+
+bool ThreadPool::stealTask(size_t index, Entry& entry) {
+    for (size_t i = 1, count = mQueues.size(); i < count; ++i) {
+        auto& queue = *mQueues[(index + i) % count];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) continue;
+        entry = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        --mQueued;
+        return true;
+    }
+    return false;
+}
+
+}
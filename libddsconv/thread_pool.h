@@ -0,0 +1,88 @@
+﻿#ifndef THREAD_POOL_H__
+#define THREAD_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace util {
+
+// ThreadPoolに投入したタスクの組。wait(TaskGroup&)はこの組のタスクだけを待つので、
+// 同じプールを使うほかのジョブやスレッドの処理には影響されない。
+// 組のタスクがすべて完了するまで破棄してはならない。
+class TaskGroup {
+public:
+    TaskGroup() = default;
+
+    TaskGroup(TaskGroup const&) = delete;
+    TaskGroup& operator=(TaskGroup const&) = delete;
+
+private:
+    friend class ThreadPool;
+
+    std::atomic<size_t> mPending{0};
+};
+
+// ワーカーごとにタスクキューを持つワークスティーリング方式のスレッドプール。
+// 各ワーカーは自分のキューを先頭(投入順)から処理し、空になると他のキューの末尾から盗む。
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    // 呼び出し元スレッドもwait()で処理に参加するため、numThreads - 1個のワーカーを起動する。
+    // numThreadsに0を指定した場合はハードウェアスレッド数を使用する。
+    explicit ThreadPool(size_t numThreads);
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    size_t getThreadCount() const noexcept { return mQueues.size(); }
+
+    // タスクをgroupに加えて投入する。ワーカー外からの投入はキューに順番に振り分ける。
+    void submit(TaskGroup& group, Task task);
+
+    // groupに投入したタスクの完了を待つ。待つ間はgroupのタスクを優先して処理し、
+    // それがなければほかの組のタスクも手伝う。
+    // タスクの中から呼び出してはならない。
+    void wait(TaskGroup& group);
+
+    // [0, count)の各インデックスに対してfuncを呼び出し、すべての完了を待つ。
+    // 呼び出し順序は不定なので、funcは互いに独立した領域にのみ書き込むこと。
+    void parallelFor(size_t count, std::function<void(size_t)> const& func);
+
+private:
+    struct Entry {
+        Task task;
+        TaskGroup* group;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Entry> tasks;
+    };
+
+    void workerMain(size_t index);
+    // groupがnullptrでない場合は、その組のタスクだけを探す。
+    bool tryRunTask(size_t index, TaskGroup* group);
+    bool popTask(size_t index, Entry& entry);
+    bool popGroupTask(TaskGroup& group, Entry& entry);
+    bool stealTask(size_t index, Entry& entry);
+
+    std::vector<std::unique_ptr<Queue>> mQueues;
+    std::vector<std::thread> mWorkers;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::atomic<size_t> mQueued{0};
+    size_t mNextQueue = 0;
+    bool mStop = false;
+};
+
+}
+
+#endif
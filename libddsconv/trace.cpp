@@ -0,0 +1,115 @@
+﻿#include "trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace util {
+
+namespace {
+
+const auto kEpoch = std::chrono::steady_clock::now();
+
+// 記録に使うスレッドの番号。0は未割り当て。
+thread_local uint32_t tlsThreadId = 0;
+
+}
+
+Tracer& Tracer::get() {
+    static Tracer tracer;
+    return tracer;
+}
+
+int64_t Tracer::now() const noexcept {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - kEpoch).count();
+}
+
+uint32_t Tracer::getThreadId() {
+    if (tlsThreadId == 0) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mThreadNames.emplace_back();
+        tlsThreadId = (uint32_t)mThreadNames.size();
+    }
+    return tlsThreadId;
+}
+
+void Tracer::record(const char* name, const char* category, int64_t begin, int64_t end, std::string args) {
+    if (!isEnabled()) return;
+    uint32_t thread = getThreadId();
+    std::lock_guard<std::mutex> lock(mMutex);
+    mEvents.push_back({ name, category, thread, begin, end, std::move(args) });
+}
+
+void Tracer::setThreadName(std::string name) {
+    uint32_t thread = getThreadId();
+    std::lock_guard<std::mutex> lock(mMutex);
+    mThreadNames[thread - 1] = std::move(name);
+}
+
+bool Tracer::write(const std::wstring& path) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::ofstream file(std::filesystem::path(path), std::ios::binary);
+    if (!file) return false;
+
+    file << "{\"traceEvents\":[\n";
+    bool first = true;
+    for (size_t i = 0; i < mThreadNames.size(); ++i) {
+        if (mThreadNames[i].empty()) continue;
+        file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i + 1
+             << ",\"args\":{\"name\":\"" << escapeJson(mThreadNames[i]) << "\"}}";
+        first = false;
+    }
+    for (auto& event : mEvents) {
+        file << (first ? "" : ",\n") << "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category
+             << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread << ",\"ts\":" << event.begin
+             << ",\"dur\":" << event.end - event.begin << ",\"args\":{" << event.args << "}}";
+        first = false;
+    }
+    file << "\n]}\n";
+    return (bool)file;
+}
+
+std::string escapeJson(const std::string& text) {
+    std::string result;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            result.push_back('\\');
+            result.push_back(c);
+        }
+        else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            result += escaped;
+        }
+        else {
+            result.push_back(c);
+        }
+    }
+    return result;
+}
+
+size_t getPeakMemoryUsage() noexcept {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakPagefileUsage;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+}
@@ -0,0 +1,90 @@
+﻿#ifndef TRACE_H__
+#define TRACE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace util {
+
+// 処理の区間をChrome trace-event形式(chrome://tracing, Perfetto)で記録する。
+// プロセスで1つだけ存在し、start()を呼ぶまでは何も記録しない。
+class Tracer {
+public:
+    static Tracer& get();
+
+    Tracer(Tracer const&) = delete;
+    Tracer& operator=(Tracer const&) = delete;
+
+    void start() noexcept { mEnabled.store(true, std::memory_order_relaxed); }
+
+    bool isEnabled() const noexcept { return mEnabled.load(std::memory_order_relaxed); }
+
+    // プロセス開始からの経過時間(マイクロ秒)。記録が無効でも使える。
+    int64_t now() const noexcept;
+
+    // [begin, end)の区間を呼び出したスレッドの区間として記録する。
+    // argsはJSONのオブジェクトの中身("key": value, ...)で、空でもよい。
+    void record(const char* name, const char* category, int64_t begin, int64_t end, std::string args = std::string());
+
+    // 呼び出したスレッドの表示名を設定する。記録が無効でも設定しておける。
+    void setThreadName(std::string name);
+
+    bool write(const std::wstring& path);
+
+private:
+    Tracer() noexcept = default;
+
+    struct Event {
+        const char* name;
+        const char* category;
+        uint32_t thread;
+        int64_t begin;
+        int64_t end;
+        std::string args;
+    };
+
+    uint32_t getThreadId();
+
+    std::atomic<bool> mEnabled{false};
+    std::mutex mMutex;
+    std::vector<Event> mEvents;
+    std::vector<std::string> mThreadNames;
+};
+
+// スコープの区間を記録する。記録が無効な場合は何もしない。
+class TraceScope {
+public:
+    TraceScope(const char* name, const char* category, std::string args = std::string())
+        : mName(name), mCategory(category), mArgs(std::move(args)) {
+        if (Tracer::get().isEnabled())
+            mBegin = Tracer::get().now();
+    }
+
+    ~TraceScope() {
+        if (mBegin >= 0)
+            Tracer::get().record(mName, mCategory, mBegin, Tracer::get().now(), std::move(mArgs));
+    }
+
+    TraceScope(TraceScope const&) = delete;
+    TraceScope& operator=(TraceScope const&) = delete;
+
+private:
+    const char* mName;
+    const char* mCategory;
+    std::string mArgs;
+    int64_t mBegin = -1;
+};
+
+// JSONの文字列として埋め込めるようにエスケープする。
+std::string escapeJson(const std::string& text);
+
+// プロセスのメモリ使用量の最大値(バイト)。取得できない場合は0。
+size_t getPeakMemoryUsage() noexcept;
+
+}
+
+#endif